@@ -0,0 +1,37 @@
+#version 330 core
+
+// input data : sent from main program
+layout (location = 0) in vec3 vertexPosition;
+layout (location = 1) in vec3 vertexColor;
+
+// per-instance data : written when a brick spawns, changes speed or is removed
+layout (location = 2) in vec4 brickSpawn;   // x, y at time t0, t0, fall rate
+layout (location = 3) in float brickColor;  // palette index, negative for an empty slot
+
+// view and projection, shared by every program and uploaded once per frame
+layout (std140) uniform Camera {
+    mat4 VP;
+};
+uniform vec3 palette[3];
+
+// game clock : seconds of unpaused play since the fall origin, which t0 is counted from too
+uniform float time;
+
+// output data : used by fragment shader
+out vec3 fragColor;
+
+void main ()
+{
+    fragColor = palette[max(int(brickColor), 0)];
+
+    // Empty slots collapse to a point outside the clip volume
+    if(brickColor < 0.0)
+    {
+        gl_Position = vec4(2, 2, 2, 1);
+        return;
+    }
+
+    // Bricks fall at a constant rate from where they were at t0
+    float y = brickSpawn.y - brickSpawn.w * (time - brickSpawn.z);
+    gl_Position = VP * vec4(vertexPosition.xy + vec2(brickSpawn.x, y), vertexPosition.z, 1);
+}
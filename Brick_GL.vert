@@ -0,0 +1,27 @@
+#version 330 core
+
+// input data : sent from main program
+layout (location = 0) in vec3 vertexPosition;
+layout (location = 1) in vec3 vertexColor;
+
+// per-instance data : one entry per live brick
+layout (location = 2) in vec2 brickOffset;
+layout (location = 3) in float brickColor;
+
+// view and projection, shared by every program and uploaded once per frame
+layout (std140) uniform Camera {
+    mat4 VP;
+};
+uniform vec3 palette[3];
+
+// output data : used by fragment shader
+out vec3 fragColor;
+
+void main ()
+{
+    // Brick colour is looked up from the palette instead of a per-vertex buffer
+    fragColor = palette[int(brickColor)];
+
+    // Bricks are never rotated, so the model transform is a plain offset
+    gl_Position = VP * vec4(vertexPosition.xy + brickOffset, vertexPosition.z, 1);
+}
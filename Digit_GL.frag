@@ -0,0 +1,39 @@
+#version 330 core
+
+// Interpolated position inside the digit cell
+in vec2 segmentCoord;
+flat in int digit;
+
+uniform vec3 tint;
+
+// Lit segments per digit, bit 0 to 6 : bottom, lower left, upper left, top, upper right, lower right, middle.
+// Entry 10 is the minus sign
+const int segments[11] = int[11](63, 48, 91, 121, 116, 109, 111, 56, 127, 125, 64);
+
+// output data
+out vec3 color;
+
+// True when the fragment lies in the bar of half size h centred at c
+bool bar(vec2 c, vec2 h)
+{
+    return all(lessThanEqual(abs(segmentCoord - c), h));
+}
+
+void main()
+{
+    // Same bars draw_rect used : 4x1 across, 1x4 upright
+    const vec2 across = vec2(2, 0.5);
+    const vec2 upright = vec2(0.5, 2);
+
+    int mask = segments[digit];
+    bool lit = ((mask & 1) != 0 && bar(vec2(0, 0), across)) ||
+               ((mask & 2) != 0 && bar(vec2(-2, 2), upright)) ||
+               ((mask & 4) != 0 && bar(vec2(-2, 6), upright)) ||
+               ((mask & 8) != 0 && bar(vec2(0, 8), across)) ||
+               ((mask & 16) != 0 && bar(vec2(2, 6), upright)) ||
+               ((mask & 32) != 0 && bar(vec2(2, 2), upright)) ||
+               ((mask & 64) != 0 && bar(vec2(0, 4), across));
+    if(!lit)
+        discard;
+    color = tint;
+}
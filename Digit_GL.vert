@@ -0,0 +1,24 @@
+#version 330 core
+
+// input data : one digit cell, relative to the centre of its bottom bar
+layout (location = 0) in vec3 vertexPosition;
+
+// per-instance data : one entry per digit on screen
+layout (location = 2) in vec2 digitOffset;
+layout (location = 3) in float digitValue;  // 0-9, 10 for a minus sign
+
+// view and projection, shared by every program and uploaded once per frame
+layout (std140) uniform Camera {
+    mat4 VP;
+};
+
+// output data : position inside the cell and which digit to light
+out vec2 segmentCoord;
+flat out int digit;
+
+void main ()
+{
+    segmentCoord = vertexPosition.xy;
+    digit = int(digitValue + 0.5);
+    gl_Position = VP * vec4(vertexPosition.xy + digitOffset, 0, 1);
+}
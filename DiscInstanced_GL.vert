@@ -0,0 +1,24 @@
+#version 330 core
+
+// input data : unit quad from -1 to 1
+layout (location = 0) in vec3 vertexPosition;
+
+// per-instance data : one entry per disc
+layout (location = 2) in vec2 discCenter;
+layout (location = 3) in float discRadius;
+
+// view and projection, shared by every program and uploaded once per frame
+layout (std140) uniform Camera {
+    mat4 VP;
+};
+
+// output data : position inside the unit disc
+out vec2 discCoord;
+
+void main ()
+{
+    discCoord = vertexPosition.xy;
+
+    // Discs are round, so the model transform is a scale and an offset
+    gl_Position = VP * vec4(discCenter + vertexPosition.xy * discRadius, 0, 1);
+}
@@ -0,0 +1,22 @@
+#version 330 core
+
+// Interpolated position inside the unit quad
+in vec2 discCoord;
+
+uniform vec3 tint;
+
+// Half-plane the disc is cut by : kept while clip.x * y + clip.y >= 0
+uniform vec2 clip;
+
+// output data
+out vec3 color;
+
+void main()
+{
+    // Signed distance to the unit circle, outside fragments are dropped
+    if(length(discCoord) - 1.0 > 0.0)
+        discard;
+    if(clip.x * discCoord.y + clip.y < 0.0)
+        discard;
+    color = tint;
+}
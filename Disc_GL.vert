@@ -0,0 +1,21 @@
+#version 330 core
+
+// input data : unit quad from -1 to 1
+layout (location = 0) in vec3 vertexPosition;
+
+// view and projection, shared by every program and uploaded once per frame
+layout (std140) uniform Camera {
+    mat4 VP;
+};
+
+// centre x, y and radii x, y
+uniform vec4 disc;
+
+// output data : position inside the unit disc
+out vec2 discCoord;
+
+void main ()
+{
+    discCoord = vertexPosition.xy;
+    gl_Position = VP * vec4(disc.xy + vertexPosition.xy * disc.zw, 0, 1);
+}
@@ -0,0 +1,33 @@
+#version 330 core
+
+// input data : the shared static buffer
+layout (location = 0) in vec3 vertexPosition;
+layout (location = 1) in vec3 vertexColor;
+
+// per-draw data : one instance per indirect command, picked by its baseInstance
+layout (location = 4) in vec4 drawTransform;  // x, y, rotation about z in degrees, uniform scale
+layout (location = 5) in vec4 drawTint;       // rgb tint, w = rotation about x in degrees
+
+// view and projection, shared by every program and uploaded once per frame
+layout (std140) uniform Camera {
+    mat4 VP;
+};
+
+// output data : used by fragment shader
+out vec3 fragColor;
+
+void main ()
+{
+    fragColor = vertexColor * drawTint.rgb;
+
+    // Same composition as Sample_GL.vert, with the uniforms replaced by per-draw attributes
+    float t = radians(drawTint.w);
+    vec3 p = vec3(vertexPosition.x,
+                  vertexPosition.y*cos(t) - vertexPosition.z*sin(t),
+                  vertexPosition.y*sin(t) + vertexPosition.z*cos(t)) * drawTransform.w;
+
+    float a = radians(drawTransform.z);
+    p.xy = mat2(cos(a), sin(a), -sin(a), cos(a)) * p.xy;
+
+    gl_Position = VP * vec4(p.xy + drawTransform.xy, p.z, 1);
+}
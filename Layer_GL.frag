@@ -0,0 +1,17 @@
+#version 330 core
+
+// The cached layer : its colours and the depth it was drawn with, one texel per pixel
+uniform sampler2D layerColor;
+uniform sampler2D layerDepth;
+
+// output data
+out vec3 color;
+
+void main()
+{
+    // Texels the layer never drew keep the cleared depth
+    ivec2 texel = ivec2(gl_FragCoord.xy);
+    if(texelFetch(layerDepth, texel, 0).r == 1.0)
+        discard;
+    color = texelFetch(layerColor, texel, 0).rgb;
+}
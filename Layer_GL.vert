@@ -0,0 +1,15 @@
+#version 330 core
+
+// input data : unit quad from -1 to 1, which covers the whole viewport in clip space
+layout (location = 0) in vec3 vertexPosition;
+
+// view and projection, shared by every program and uploaded once per frame
+layout (std140) uniform Camera {
+    mat4 VP;
+};
+
+void main ()
+{
+    // Composited at the depth of the z = 0 plane the rest of the scene is drawn in
+    gl_Position = vec4(vertexPosition.xy, (VP * vec4(0, 0, 0, 1)).z, 1);
+}
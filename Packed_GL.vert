@@ -0,0 +1,36 @@
+#version 330 core
+
+// input data : interleaved 2D position and normalized byte colour
+layout (location = 0) in vec2 vertexPosition;
+layout (location = 1) in vec4 vertexColor;
+
+// view and projection, shared by every program and uploaded once per frame
+layout (std140) uniform Camera {
+    mat4 VP;
+};
+
+// per-object placement : x, y, rotation about z in degrees, uniform scale
+uniform vec4 transform;
+
+// rotation about x in degrees, applied before the rest (tipped bucket rims)
+uniform float tilt;
+
+// per-draw colour, multiplied into the vertex colour
+uniform vec3 tint;
+
+// output data : used by fragment shader
+out vec3 fragColor;
+
+void main ()
+{
+    fragColor = vertexColor.rgb * tint;
+
+    // z is always 0 for the 2D game, so it is not stored per vertex
+    float t = radians(tilt);
+    vec3 p = vec3(vertexPosition.x, vertexPosition.y*cos(t), vertexPosition.y*sin(t)) * transform.w;
+
+    float a = radians(transform.z);
+    p.xy = mat2(cos(a), sin(a), -sin(a), cos(a)) * p.xy;
+
+    gl_Position = VP * vec4(p.xy + transform.xy, p.z, 1);
+}
@@ -0,0 +1,55 @@
+#version 330 core
+
+// input data : last frame's particles, read from one half of the ping-pong pair
+layout (location = 0) in vec2 particlePosition;
+layout (location = 1) in vec2 particleVelocity;
+layout (location = 2) in float particleLife;
+layout (location = 3) in vec3 particleColor;
+
+const int MAX_BURSTS = 8;
+const int PARTICLES_PER_BURST = 64;
+
+// bursts started this frame : centre x, y and the first particle they take over, and their colour
+uniform vec4 bursts[MAX_BURSTS];
+uniform vec3 burstColors[MAX_BURSTS];
+uniform int burstCount;
+
+// game seconds since the last update, 0 while paused
+uniform float dt;
+uniform float lifetime;
+
+// output data : captured by transform feedback into the other half
+out vec2 position;
+out vec2 velocity;
+out float life;
+out vec3 color;
+
+float hash (float n)
+{
+    return fract(sin(n) * 43758.5453);
+}
+
+void main ()
+{
+    for(int b = 0; b < burstCount; b++)
+    {
+        int first = int(bursts[b].z);
+        if(gl_VertexID >= first && gl_VertexID < first + PARTICLES_PER_BURST)
+        {
+            // Scatter the burst's particles in every direction at varying speeds
+            float angle = 6.2831853 * hash(float(gl_VertexID) * 12.9898 + bursts[b].x);
+            float speed = 20.0 + 40.0 * hash(float(gl_VertexID) * 78.233 + bursts[b].y);
+            position = bursts[b].xy;
+            velocity = speed * vec2(cos(angle), sin(angle));
+            life = lifetime;
+            color = burstColors[b];
+            return;
+        }
+    }
+
+    // Everything else falls under gravity and ages; dead particles just stay dead
+    velocity = particleVelocity + vec2(0, -80) * dt;
+    position = particlePosition + velocity * dt;
+    life = particleLife - dt;
+    color = particleColor;
+}
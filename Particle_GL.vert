@@ -0,0 +1,27 @@
+#version 330 core
+
+// input data : the particles the last update wrote
+layout (location = 0) in vec2 particlePosition;
+layout (location = 2) in float particleLife;
+layout (location = 3) in vec3 particleColor;
+
+// view and projection, shared by every program and uploaded once per frame
+layout (std140) uniform Camera {
+    mat4 VP;
+};
+uniform float lifetime;
+
+// output data : used by fragment shader
+out vec3 fragColor;
+
+void main ()
+{
+    fragColor = particleColor;
+    gl_PointSize = 1.0 + 3.0 * max(particleLife, 0.0) / lifetime;
+
+    // Dead particles are moved outside the clip volume
+    if(particleLife <= 0.0)
+        gl_Position = vec4(2, 2, 2, 1);
+    else
+        gl_Position = VP * vec4(particlePosition, 0, 1);
+}
@@ -4,19 +4,37 @@
 layout (location = 0) in vec3 vertexPosition;
 layout (location = 1) in vec3 vertexColor;
 
-uniform mat4 MVP;
+// view and projection, shared by every program and uploaded once per frame
+layout (std140) uniform Camera {
+    mat4 VP;
+};
+
+// per-object placement : x, y, rotation about z in degrees, uniform scale
+uniform vec4 transform;
+
+// rotation about x in degrees, applied before the rest (tipped bucket rims)
+uniform float tilt;
+
+// per-draw colour, multiplied into the vertex colour
+uniform vec3 tint;
 
 // output data : used by fragment shader
 out vec3 fragColor;
 
 void main ()
 {
-    vec4 v = vec4(vertexPosition, 1); // Transform an homogeneous 4D vector
-
     // The color of each vertex will be interpolated
     // to produce the color of each fragment
-    fragColor = vertexColor;
+    fragColor = vertexColor * tint;
+
+    float t = radians(tilt);
+    vec3 p = vec3(vertexPosition.x,
+                  vertexPosition.y*cos(t) - vertexPosition.z*sin(t),
+                  vertexPosition.y*sin(t) + vertexPosition.z*cos(t)) * transform.w;
+
+    float a = radians(transform.z);
+    p.xy = mat2(cos(a), sin(a), -sin(a), cos(a)) * p.xy;
 
-    // Output position of the vertex, in clip space : MVP * position
-    gl_Position = MVP * v;
+    // Output position of the vertex, in clip space : VP * model * position
+    gl_Position = VP * vec4(p.xy + transform.xy, p.z, 1);
 }
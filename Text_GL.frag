@@ -0,0 +1,20 @@
+#version 330 core
+
+// Interpolated position in the glyph atlas
+in vec2 atlasCoord;
+
+// Stroke coverage, baked by glyphs.h
+uniform sampler2D atlas;
+
+uniform vec3 tint;
+
+// output data
+out vec3 color;
+
+void main()
+{
+    // Filtered coverage below one half is outside the strokes
+    if(texture(atlas, atlasCoord).r < 0.5)
+        discard;
+    color = tint;
+}
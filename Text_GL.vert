@@ -0,0 +1,19 @@
+#version 330 core
+
+// input data : label quads in world space and their place in the glyph atlas
+layout (location = 0) in vec2 vertexPosition;
+layout (location = 1) in vec2 vertexUV;
+
+// view and projection, shared by every program and uploaded once per frame
+layout (std140) uniform Camera {
+    mat4 VP;
+};
+
+// output data : used by fragment shader
+out vec2 atlasCoord;
+
+void main ()
+{
+    atlasCoord = vertexUV;
+    gl_Position = VP * vec4(vertexPosition, 0, 1);
+}
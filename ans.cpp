@@ -4,6 +4,14 @@
 #include <vector>
 #include <ctime>
 #include <list>
+#include <map>
+#include <algorithm>
+#include <cstring>
+#include <cstddef>
+#include <thread>
+#include <chrono>
+#include <atomic>
+#include <mutex>
 
 
 
@@ -15,9 +23,18 @@
 #include <glm/gtx/transform.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 
+#include "geometry.h"
+#include "glyphs.h"
+
 using namespace std;
 
+/* Owning handle for a mesh - deleting it releases the GL objects it owns */
 struct VAO {
+    VAO () : OwnsGLObjects(false) {}
+    ~VAO ();
+    VAO (const VAO&) = delete;
+    VAO& operator= (const VAO&) = delete;
+
     GLuint VertexArrayID;
     GLuint VertexBuffer;
     GLuint ColorBuffer;
@@ -25,6 +42,15 @@ struct VAO {
     GLenum PrimitiveMode;
     GLenum FillMode;
     int NumVertices;
+
+    GLuint IndexBuffer;    // shared element buffer, used when NumIndices > 0
+    int NumIndices;
+    int BaseVertex;        // first vertex of this mesh in its vertex buffer
+
+    bool PerVertexColor;   // false : colour comes from the tint uniform only
+    GLfloat Color[3];      // tint used when the object is drawn without one
+
+    bool OwnsGLObjects;    // false for meshes living in a shared buffer
 };
 typedef struct VAO VAO;
 
@@ -32,17 +58,21 @@ struct GLMatrices {
     glm::mat4 projection;
     glm::mat4 model;
     glm::mat4 view;
-    GLuint MatrixID;
+    GLuint TransformID;
+    GLuint TiltID;
+    GLuint TintID;
 } Matrices;
 
 GLuint programID;
 
-/* Function to load Shaders - Use it as it is */
-GLuint LoadShaders(const char * vertex_file_path,const char * fragment_file_path) {
+/* Function to load Shaders - Use it as it is.
+   Transform feedback programs also name the varyings they capture (interleaved, in that order),
+   and may leave out the fragment shader when they only run with rasterization discarded */
+GLuint LoadShaders(const char * vertex_file_path,const char * fragment_file_path,const char * const * varyings=NULL,int varying_count=0) {
 
     // Create the shaders
     GLuint VertexShaderID = glCreateShader(GL_VERTEX_SHADER);
-    GLuint FragmentShaderID = glCreateShader(GL_FRAGMENT_SHADER);
+    GLuint FragmentShaderID = fragment_file_path ? glCreateShader(GL_FRAGMENT_SHADER) : 0;
 
     // Read the Vertex Shader code from the file
     std::string VertexShaderCode;
@@ -57,7 +87,9 @@ GLuint LoadShaders(const char * vertex_file_path,const char * fragment_file_path
 
     // Read the Fragment Shader code from the file
     std::string FragmentShaderCode;
-    std::ifstream FragmentShaderStream(fragment_file_path, std::ios::in);
+    std::ifstream FragmentShaderStream;
+    if(fragment_file_path)
+        FragmentShaderStream.open(fragment_file_path, std::ios::in);
     if(FragmentShaderStream.is_open()){
         std::string Line = "";
         while(getline(FragmentShaderStream, Line))
@@ -81,6 +113,8 @@ GLuint LoadShaders(const char * vertex_file_path,const char * fragment_file_path
     glGetShaderInfoLog(VertexShaderID, InfoLogLength, NULL, &VertexShaderErrorMessage[0]);
     fprintf(stdout, "%s\n", &VertexShaderErrorMessage[0]);
 
+    if(fragment_file_path)
+    {
     // Compile Fragment Shader
     printf("Compiling shader : %s\n", fragment_file_path);
     char const * FragmentSourcePointer = FragmentShaderCode.c_str();
@@ -93,12 +127,16 @@ GLuint LoadShaders(const char * vertex_file_path,const char * fragment_file_path
     std::vector<char> FragmentShaderErrorMessage(InfoLogLength);
     glGetShaderInfoLog(FragmentShaderID, InfoLogLength, NULL, &FragmentShaderErrorMessage[0]);
     fprintf(stdout, "%s\n", &FragmentShaderErrorMessage[0]);
+    }
 
     // Link the program
     fprintf(stdout, "Linking program\n");
     GLuint ProgramID = glCreateProgram();
     glAttachShader(ProgramID, VertexShaderID);
-    glAttachShader(ProgramID, FragmentShaderID);
+    if(fragment_file_path)
+        glAttachShader(ProgramID, FragmentShaderID);
+    if(varying_count>0)
+        glTransformFeedbackVaryings(ProgramID, varying_count, varyings, GL_INTERLEAVED_ATTRIBS);
     glLinkProgram(ProgramID);
 
     // Check the program
@@ -109,7 +147,8 @@ GLuint LoadShaders(const char * vertex_file_path,const char * fragment_file_path
     fprintf(stdout, "%s\n", &ProgramErrorMessage[0]);
 
     glDeleteShader(VertexShaderID);
-    glDeleteShader(FragmentShaderID);
+    if(fragment_file_path)
+        glDeleteShader(FragmentShaderID);
 
     return ProgramID;
 }
@@ -121,27 +160,377 @@ static void error_callback(int error, const char* description)
 
 void quit(GLFWwindow *window)
 {
-    glfwDestroyWindow(window);
-    glfwTerminate();
+    // The main loop ends the frame, releases GL objects and then destroys the window
+    glfwSetWindowShouldClose(window, GL_TRUE);
 //    exit(EXIT_SUCCESS);
 }
 
-/* Generate VAO, VBOs and return VAO handle */
-struct VAO* create3DObject (GLenum primitive_mode, int numVertices, const GLfloat* vertex_buffer_data, const GLfloat* color_buffer_data, GLenum fill_mode=GL_FILL)
+double millisecondsSince (std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now()-start).count();
+}
+
+long long int gl_buffers_created=0;
+long long int bytes_uploaded=0,mesh_bytes_uploaded=0;
+
+/* GL work done for the frame being drawn, reported per frame with --stats */
+struct FrameStats {
+    long long int draw_calls;
+    long long int vao_binds;
+    long long int buffer_binds;
+    long long int hud_quads;       // quads queued by the HUD batcher, one draw each before batching
+    long long int hud_draw_calls;  // draws the HUD batcher actually issued
+    long long int gl_calls_issued;   // binds, program and mode changes that reached GL
+    long long int gl_calls_skipped;  // the same calls dropped because the state was already current
+    long long int render_commands;   // commands submitted to the render queue
+    long long int merged_draws;      // queued draws folded into an indirect multi-draw
+    long long int objects_drawn;     // objects whose bounds met the view
+    long long int objects_culled;    // objects left out because they were outside it
+    long long int stream_bytes;      // bytes written to the streaming buffer
+    long long int stream_fence_waits;  // regions the CPU had to wait for the GPU to release
+    double update_ms;    // game logic for the tick drawn
+    double extract_ms;   // turning that tick's entities into draw records
+    double render_ms;    // sorting and drawing the records
+    long long int layer_redraws;   // cached static layers drawn again into their textures
+};
+FrameStats frame_stats,total_stats;
+
+/* The game updates on its own thread and hands each tick's draw data to the render thread through a
+   triple buffer. Per-frame data is kept once per slot : the update thread writes slot update_slot, the
+   render thread draws render_slot, and the third is the latest finished tick (see publishSnapshot) */
+const int SNAPSHOT_SLOTS = 3;
+const int SNAPSHOT_NEW = 4;        // set in ready_slot until the render thread takes the slot
+int update_slot=0,render_slot=1;   // each owned by one thread
+std::atomic<int> ready_slot(2);
+FrameStats update_stats[SNAPSHOT_SLOTS];  // counted while the slot was built, folded into frame_stats when drawn
+double snapshot_clocks[SNAPSHOT_SLOTS];   // game clock of the tick the slot holds
+
+/* Game state belongs to the update thread. The input callbacks run on the main thread, so they queue
+   their events for the next tick to apply, and the cursor, which can only be read there, is copied here */
+enum InputEventType { INPUT_KEY, INPUT_MOUSE_BUTTON, INPUT_SCROLL };
+struct InputEvent {
+    int type;
+    int code,action;  // key or mouse button, and GLFW_PRESS / GLFW_RELEASE
+    double x,y;       // cursor position for mouse buttons, offsets for scrolling
+};
+std::mutex input_mutex;
+std::vector<InputEvent> input_events;
+std::atomic<double> cursor_x(0),cursor_y(0);
+std::atomic<bool> update_running(false);
+const double UPDATE_RATE = 60;  // ticks per second, the rate vsync paced the game at before
+long long int frames_drawn=0;
+bool snapshot_drawn=false;  // set by render() once it has drawn a published tick rather than an empty slot
+int print_stats=0;
+
+/* Vertex layouts create3DObject can build */
+enum VertexFormat {
+    VERTEX_FLOAT3,        // separate x,y,z and r,g,b float buffers (24 bytes per vertex)
+    VERTEX_PACKED_FLOAT,  // interleaved x,y floats + r,g,b,a bytes (12 bytes per vertex)
+    VERTEX_PACKED_HALF,   // interleaved x,y halfs + r,g,b,a bytes (8 bytes per vertex)
+};
+int vertex_format = VERTEX_FLOAT3;
+
+struct PackedVertex {
+    GLfloat x,y;
+    GLubyte r,g,b,a;
+};
+
+struct PackedVertexHalf {
+    GLhalf x,y;
+    GLubyte r,g,b,a;
+};
+
+/* IEEE half from float, rounded to nearest - values too small for a half become zero */
+GLhalf floatToHalf (float value)
+{
+    unsigned int bits;
+    memcpy(&bits, &value, sizeof(bits));
+    unsigned int sign = (bits>>16) & 0x8000;
+    int exponent = (int)((bits>>23) & 0xff) - 127 + 15;
+    unsigned int mantissa = bits & 0x7fffff;
+    if(exponent<=0)
+        return sign;
+    if(exponent>=31)
+        return sign | 0x7c00;
+    return sign | ((exponent<<10) + ((mantissa+0x1000)>>13));
+}
+
+GLubyte colorToByte (float value)
+{
+    if(value<=0)
+        return 0;
+    if(value>=1)
+        return 255;
+    return (GLubyte)(value*255+0.5f);
+}
+
+/* Pack vertices in the current packed format into out, returning the stride. No GL calls, so it can run off the GL thread.
+   Without a colour array every vertex is white and the tint uniform supplies the colour */
+GLsizei packVertices (int numVertices, const GLfloat* vertex_buffer_data, const GLfloat* color_buffer_data, std::vector<GLubyte>& out)
+{
+    static const GLfloat white[3] = {1,1,1};
+    if(vertex_format==VERTEX_PACKED_HALF)
+    {
+        out.resize(numVertices*sizeof(PackedVertexHalf));
+        PackedVertexHalf* packed = (PackedVertexHalf*)&out[0];
+        for(int i=0;i<numVertices;i++)
+        {
+            packed[i].x = floatToHalf(vertex_buffer_data[3*i]);
+            packed[i].y = floatToHalf(vertex_buffer_data[3*i+1]);
+            const GLfloat* color = color_buffer_data ? &color_buffer_data[3*i] : white;
+            packed[i].r = colorToByte(color[0]);
+            packed[i].g = colorToByte(color[1]);
+            packed[i].b = colorToByte(color[2]);
+            packed[i].a = 255;
+        }
+        return sizeof(PackedVertexHalf);
+    }
+    out.resize(numVertices*sizeof(PackedVertex));
+    PackedVertex* packed = (PackedVertex*)&out[0];
+    for(int i=0;i<numVertices;i++)
+    {
+        packed[i].x = vertex_buffer_data[3*i];
+        packed[i].y = vertex_buffer_data[3*i+1];
+        const GLfloat* color = color_buffer_data ? &color_buffer_data[3*i] : white;
+        packed[i].r = colorToByte(color[0]);
+        packed[i].g = colorToByte(color[1]);
+        packed[i].b = colorToByte(color[2]);
+        packed[i].a = 255;
+    }
+    return sizeof(PackedVertex);
+}
+
+/* Point attributes 0 and 1 of the bound VAO at packed vertices in the bound GL_ARRAY_BUFFER */
+void pointPackedAttributes (GLsizei stride)
+{
+    if(vertex_format==VERTEX_PACKED_HALF)
+    {
+        glVertexAttribPointer(0, 2, GL_HALF_FLOAT, GL_FALSE, stride, (void*)0);
+        glVertexAttribPointer(1, 4, GL_UNSIGNED_BYTE, GL_TRUE, stride, (void*)offsetof(PackedVertexHalf, r));
+    }
+    else
+    {
+        glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, stride, (void*)0);
+        glVertexAttribPointer(1, 4, GL_UNSIGNED_BYTE, GL_TRUE, stride, (void*)offsetof(PackedVertex, r));
+    }
+    glEnableVertexAttribArray(0);
+    glEnableVertexAttribArray(1);
+}
+
+/* Copy packed vertices into the bound GL_ARRAY_BUFFER and point attributes 0 and 1 at them */
+void uploadPackedVertices (const std::vector<GLubyte>& packed, GLsizei stride)
+{
+    glBufferData (GL_ARRAY_BUFFER, packed.size(), &packed[0], GL_STATIC_DRAW);
+    pointPackedAttributes(stride);
+    bytes_uploaded += packed.size();
+    mesh_bytes_uploaded += packed.size();
+}
+
+/* GL state cache - binds and mode changes go through these, and calls that would leave the state
+   as it is never reach the driver. --no-state-cache issues every call, for comparison */
+int use_state_cache=1;
+GLuint bound_vao=0,bound_array_buffer=0,bound_program=0;
+GLenum polygon_mode=GL_FILL;
+
+/* Count a state call and say whether it has to be issued */
+bool issueStateCall (bool changes_state)
+{
+    if(changes_state || !use_state_cache)
+    {
+        frame_stats.gl_calls_issued++;
+        return true;
+    }
+    frame_stats.gl_calls_skipped++;
+    return false;
+}
+
+void bindVertexArray (GLuint vao_id)
+{
+    if(!issueStateCall(bound_vao!=vao_id))
+        return;
+    glBindVertexArray (vao_id);
+    bound_vao = vao_id;
+    frame_stats.vao_binds++;
+}
+
+void bindArrayBuffer (GLuint buffer_id)
+{
+    if(!issueStateCall(bound_array_buffer!=buffer_id))
+        return;
+    glBindBuffer (GL_ARRAY_BUFFER, buffer_id);
+    bound_array_buffer = buffer_id;
+    frame_stats.buffer_binds++;
+}
+
+void setPolygonMode (GLenum mode)
+{
+    if(!issueStateCall(polygon_mode!=mode))
+        return;
+    glPolygonMode (GL_FRONT_AND_BACK, mode);
+    polygon_mode = mode;
+}
+
+/* GL object lifetime - every buffer, vertex array, texture and framebuffer goes through these so leaks show up at exit */
+long long int live_buffers=0,live_vertex_arrays=0,live_textures=0,live_framebuffers=0;
+
+GLuint genBuffer ()
+{
+    GLuint id;
+    glGenBuffers (1, &id);
+    gl_buffers_created++;
+    live_buffers++;
+    return id;
+}
+
+void deleteBuffer (GLuint& id)
+{
+    if(id==0)
+        return;
+    if(bound_array_buffer==id)
+        bound_array_buffer = 0;
+    glDeleteBuffers (1, &id);
+    live_buffers--;
+    id = 0;
+}
+
+GLuint genVertexArray ()
+{
+    GLuint id;
+    glGenVertexArrays (1, &id);
+    live_vertex_arrays++;
+    return id;
+}
+
+void deleteVertexArray (GLuint& id)
+{
+    if(id==0)
+        return;
+    if(bound_vao==id)
+        bound_vao = 0;
+    glDeleteVertexArrays (1, &id);
+    live_vertex_arrays--;
+    id = 0;
+}
+
+GLuint genTexture ()
+{
+    GLuint id;
+    glGenTextures (1, &id);
+    live_textures++;
+    return id;
+}
+
+void deleteTexture (GLuint& id)
+{
+    if(id==0)
+        return;
+    glDeleteTextures (1, &id);
+    live_textures--;
+    id = 0;
+}
+
+GLuint genFramebuffer ()
+{
+    GLuint id;
+    glGenFramebuffers (1, &id);
+    live_framebuffers++;
+    return id;
+}
+
+void deleteFramebuffer (GLuint& id)
+{
+    if(id==0)
+        return;
+    glDeleteFramebuffers (1, &id);
+    live_framebuffers--;
+    id = 0;
+}
+
+VAO::~VAO ()
+{
+    if(!OwnsGLObjects)
+        return;
+    deleteVertexArray(VertexArrayID);
+    deleteBuffer(VertexBuffer);
+    deleteBuffer(ColorBuffer);
+}
+
+/* Startup meshes are gathered on the CPU while collecting and then uploaded by
+   uploadStaticMeshes() into one VAO, each mesh keeping its base vertex */
+int use_static_buffer=1;
+bool collecting_static_meshes=false;
+std::vector<GLfloat> static_positions,static_colors;
+std::vector<struct VAO*> static_meshes;
+std::vector<GLubyte> static_packed;
+GLsizei static_packed_stride=0;
+GLuint static_vao=0,static_vertex_buffer=0,static_color_buffer=0;
+
+struct VAO* newVAO (GLenum primitive_mode, int numVertices, GLenum fill_mode)
 {
     struct VAO* vao = new struct VAO;
     vao->PrimitiveMode = primitive_mode;
     vao->NumVertices = numVertices;
     vao->FillMode = fill_mode;
+    vao->VertexArrayID = 0;
+    vao->VertexBuffer = 0;
+    vao->ColorBuffer = 0;
+    vao->IndexBuffer = 0;
+    vao->NumIndices = 0;
+    vao->BaseVertex = 0;
+    vao->PerVertexColor = true;
+    vao->Color[0] = vao->Color[1] = vao->Color[2] = 1;
+    vao->OwnsGLObjects = false;
+    return vao;
+}
+
+/* Interleaved 2D position + byte colour in one VBO. z is dropped, the shader treats it as 0 */
+struct VAO* create3DObjectPacked (GLenum primitive_mode, int numVertices, const GLfloat* vertex_buffer_data, const GLfloat* color_buffer_data, GLenum fill_mode)
+{
+    struct VAO* vao = newVAO(primitive_mode, numVertices, fill_mode);
+
+    vao->VertexArrayID = genVertexArray();
+    vao->VertexBuffer = genBuffer();
+    vao->OwnsGLObjects = true;
+
+    bindVertexArray (vao->VertexArrayID);
+    bindArrayBuffer (vao->VertexBuffer);
+    std::vector<GLubyte> packed;
+    GLsizei stride = packVertices(numVertices, vertex_buffer_data, color_buffer_data, packed);
+    uploadPackedVertices(packed, stride);
+
+    return vao;
+}
+
+/* Generate VAO, VBOs and return VAO handle */
+struct VAO* create3DObject (GLenum primitive_mode, int numVertices, const GLfloat* vertex_buffer_data, const GLfloat* color_buffer_data, GLenum fill_mode=GL_FILL)
+{
+    if(collecting_static_meshes)
+    {
+        // Keep the data for the shared buffer; meshes there always carry a colour, white when untinted
+        struct VAO* vao = newVAO(primitive_mode, numVertices, fill_mode);
+        vao->BaseVertex = static_positions.size()/3;
+        static_positions.insert(static_positions.end(), vertex_buffer_data, vertex_buffer_data+3*numVertices);
+        if(color_buffer_data)
+            static_colors.insert(static_colors.end(), color_buffer_data, color_buffer_data+3*numVertices);
+        else
+            static_colors.resize(static_colors.size()+3*numVertices, 1.0f);
+        static_meshes.push_back(vao);
+        return vao;
+    }
+
+    if(vertex_format!=VERTEX_FLOAT3)
+        return create3DObjectPacked(primitive_mode, numVertices, vertex_buffer_data, color_buffer_data, fill_mode);
+
+    struct VAO* vao = newVAO(primitive_mode, numVertices, fill_mode);
 
     // Create Vertex Array Object
     // Should be done after CreateWindow and before any other GL calls
-    glGenVertexArrays(1, &(vao->VertexArrayID)); // VAO
-    glGenBuffers (1, &(vao->VertexBuffer)); // VBO - vertices
-    glGenBuffers (1, &(vao->ColorBuffer));  // VBO - colors
+    vao->VertexArrayID = genVertexArray(); // VAO
+    vao->VertexBuffer = genBuffer(); // VBO - vertices
+    vao->OwnsGLObjects = true;
 
-    glBindVertexArray (vao->VertexArrayID); // Bind the VAO 
-    glBindBuffer (GL_ARRAY_BUFFER, vao->VertexBuffer); // Bind the VBO vertices 
+    bindVertexArray (vao->VertexArrayID); // Bind the VAO 
+    bindArrayBuffer (vao->VertexBuffer); // Bind the VBO vertices 
     glBufferData (GL_ARRAY_BUFFER, 3*numVertices*sizeof(GLfloat), vertex_buffer_data, GL_STATIC_DRAW); // Copy the vertices into VBO
     glVertexAttribPointer(
                           0,                  // attribute 0. Vertices
@@ -151,8 +540,20 @@ struct VAO* create3DObject (GLenum primitive_mode, int numVertices, const GLfloa
                           0,                  // stride
                           (void*)0            // array buffer offset
                           );
+    glEnableVertexAttribArray(0);
+
+    bytes_uploaded += 3*numVertices*sizeof(GLfloat);
+    mesh_bytes_uploaded += 3*numVertices*sizeof(GLfloat);
 
-    glBindBuffer (GL_ARRAY_BUFFER, vao->ColorBuffer); // Bind the VBO colors 
+    // Single coloured objects have no colour VBO - attribute 1 stays disabled and reads white
+    if(color_buffer_data==NULL)
+    {
+        vao->PerVertexColor = false;
+        return vao;
+    }
+
+    vao->ColorBuffer = genBuffer();  // VBO - colors
+    bindArrayBuffer (vao->ColorBuffer); // Bind the VBO colors 
     glBufferData (GL_ARRAY_BUFFER, 3*numVertices*sizeof(GLfloat), color_buffer_data, GL_STATIC_DRAW);  // Copy the vertex colors
     glVertexAttribPointer(
                           1,                  // attribute 1. Color
@@ -162,44 +563,311 @@ struct VAO* create3DObject (GLenum primitive_mode, int numVertices, const GLfloa
                           0,                  // stride
                           (void*)0            // array buffer offset
                           );
+    glEnableVertexAttribArray(1);
+    bytes_uploaded += 3*numVertices*sizeof(GLfloat);
+    mesh_bytes_uploaded += 3*numVertices*sizeof(GLfloat);
 
     return vao;
 }
 
-/* Generate VAO, VBOs and return VAO handle - Common Color for all vertices */
+/* Generate VAO, VBOs and return VAO handle - Common Color for all vertices, applied as a tint when drawn */
 struct VAO* create3DObject (GLenum primitive_mode, int numVertices, const GLfloat* vertex_buffer_data, const GLfloat red, const GLfloat green, const GLfloat blue, GLenum fill_mode=GL_FILL)
 {
-    GLfloat* color_buffer_data = new GLfloat [3*numVertices];
-    for (int i=0; i<numVertices; i++) {
-        color_buffer_data [3*i] = red;
-        color_buffer_data [3*i + 1] = green;
-        color_buffer_data [3*i + 2] = blue;
+    struct VAO* vao = create3DObject(primitive_mode, numVertices, vertex_buffer_data, NULL, fill_mode);
+    vao->Color[0] = red;
+    vao->Color[1] = green;
+    vao->Color[2] = blue;
+    return vao;
+}
+
+/* One element buffer shared by every rectangle */
+GLuint quad_index_buffer=0;
+
+/* Bind the shared quad indices to the bound VAO, creating them on first use */
+void bindQuadIndexBuffer ()
+{
+    if(quad_index_buffer==0)
+    {
+        quad_index_buffer = genBuffer();
+        glBindBuffer (GL_ELEMENT_ARRAY_BUFFER, quad_index_buffer);
+        glBufferData (GL_ELEMENT_ARRAY_BUFFER, sizeof(geometry::quad_indices), geometry::quad_indices, GL_STATIC_DRAW);
+        bytes_uploaded += sizeof(geometry::quad_indices);
+    }
+    else
+        glBindBuffer (GL_ELEMENT_ARRAY_BUFFER, quad_index_buffer);
+}
+
+/* Rectangle from (x0,y0) to (x1,y1) as 4 vertices and the shared quad indices */
+struct VAO* createQuadObject (GLfloat x0, GLfloat y0, GLfloat x1, GLfloat y1, const GLfloat red, const GLfloat green, const GLfloat blue, GLenum fill_mode=GL_FILL)
+{
+    const geometry::IndexedQuad quad(x0,y0,x1,y1);
+    struct VAO* vao = create3DObject(GL_TRIANGLES, quad.vertices, quad.data, red, green, blue, fill_mode);
+    vao->NumIndices = 6;
+    if(collecting_static_meshes)
+        return vao;
+
+    // The element buffer binding is part of the VAO state
+    bindVertexArray (vao->VertexArrayID);
+    bindQuadIndexBuffer();
+    vao->IndexBuffer = quad_index_buffer;
+    return vao;
+}
+
+/* CPU side of the static buffer : stop collecting and pack the vertices if a packed format is in use */
+void buildStaticMeshes ()
+{
+    collecting_static_meshes = false;
+    if(vertex_format!=VERTEX_FLOAT3 && !static_positions.empty())
+        static_packed_stride = packVertices(static_positions.size()/3, &static_positions[0], &static_colors[0], static_packed);
+}
+
+/* Point attributes 0 and 1 of the bound VAO at the static buffer, for any VAO that draws from it */
+void pointStaticAttributes ()
+{
+    bindArrayBuffer (static_vertex_buffer);
+    if(vertex_format!=VERTEX_FLOAT3)
+    {
+        pointPackedAttributes(static_packed_stride);
+        return;
+    }
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, (void*)0);
+    bindArrayBuffer (static_color_buffer);
+    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 0, (void*)0);
+    glEnableVertexAttribArray(0);
+    glEnableVertexAttribArray(1);
+}
+
+/* Upload every mesh collected since collecting_static_meshes was set into one VAO, in one pass */
+void uploadStaticMeshes ()
+{
+    if(collecting_static_meshes)
+        buildStaticMeshes();
+    int numVertices = static_positions.size()/3;
+    if(numVertices==0)
+        return;
+
+    static_vao = genVertexArray();
+    static_vertex_buffer = genBuffer();
+    bindVertexArray (static_vao);
+    bindArrayBuffer (static_vertex_buffer);
+
+    if(vertex_format==VERTEX_FLOAT3)
+    {
+        glBufferData (GL_ARRAY_BUFFER, static_positions.size()*sizeof(GLfloat), &static_positions[0], GL_STATIC_DRAW);
+        static_color_buffer = genBuffer();
+        bindArrayBuffer (static_color_buffer);
+        glBufferData (GL_ARRAY_BUFFER, static_colors.size()*sizeof(GLfloat), &static_colors[0], GL_STATIC_DRAW);
+        pointStaticAttributes();
+        bytes_uploaded += 6*numVertices*sizeof(GLfloat);
+        mesh_bytes_uploaded += 6*numVertices*sizeof(GLfloat);
+    }
+    else
+        uploadPackedVertices(static_packed, static_packed_stride);
+    bindQuadIndexBuffer();
+
+    for(size_t i=0;i<static_meshes.size();i++)
+    {
+        static_meshes[i]->VertexArrayID = static_vao;
+        static_meshes[i]->VertexBuffer = static_vertex_buffer;
+        static_meshes[i]->ColorBuffer = static_color_buffer;
+        if(static_meshes[i]->NumIndices>0)
+            static_meshes[i]->IndexBuffer = quad_index_buffer;
     }
+    static_positions.clear();
+    static_colors.clear();
+    static_packed.clear();
+}
+
+/* Release the shared static buffer. Meshes in it do not own GL objects, so they can be deleted before or after */
+void releaseStaticMeshes ()
+{
+    deleteVertexArray(static_vao);
+    deleteBuffer(static_vertex_buffer);
+    deleteBuffer(static_color_buffer);
+    static_meshes.clear();
+}
+
+/* Tint uniform of the program in use, and the value last sent to it */
+GLint current_tint_id=-1;
+GLfloat current_tint[3];
+
+/* Bind a shader program. tint_id is its "tint" uniform location, or -1 if it has none */
+void useProgram (GLuint program, GLint tint_id)
+{
+    if(!issueStateCall(bound_program!=program))
+        return;
+    glUseProgram (program);
+    bound_program = program;
+    current_tint_id = tint_id;
+    current_tint[0] = -1;
+}
 
-    return create3DObject(primitive_mode, numVertices, vertex_buffer_data, color_buffer_data, fill_mode);
+/* Colour multiplied into every vertex colour of the following draws */
+void setTint (GLfloat red, GLfloat green, GLfloat blue)
+{
+    if(current_tint_id<0)
+        return;
+    if(!issueStateCall(current_tint[0]!=red || current_tint[1]!=green || current_tint[2]!=blue))
+        return;
+    glUniform3f(current_tint_id,red,green,blue);
+    current_tint[0] = red;
+    current_tint[1] = green;
+    current_tint[2] = blue;
 }
 
 /* Render the VBOs handled by VAO */
-void draw3DObject (struct VAO* vao)
+void draw3DObject (struct VAO* vao, GLfloat red, GLfloat green, GLfloat blue)
 {
+    setTint(red,green,blue);
     // Change the Fill Mode for this object
-    glPolygonMode (GL_FRONT_AND_BACK, vao->FillMode);
+    setPolygonMode (vao->FillMode);
 
-    // Bind the VAO to use
-    glBindVertexArray (vao->VertexArrayID);
+    // Bind the VAO to use - meshes in the static buffer share one, so it is only bound when switching to it.
+    // Attribute enables and buffers are VAO state set up when the mesh was made, so nothing else is bound here
+    bindVertexArray (vao->VertexArrayID);
 
-    // Enable Vertex Attribute 0 - 3d Vertices
-    glEnableVertexAttribArray(0);
-    // Bind the VBO to use
-    glBindBuffer(GL_ARRAY_BUFFER, vao->VertexBuffer);
+    // Draw the geometry !
+    if(vao->NumIndices>0)
+        glDrawElementsBaseVertex(vao->PrimitiveMode, vao->NumIndices, GL_UNSIGNED_SHORT, (void*)0, vao->BaseVertex);
+    else
+        glDrawArrays(vao->PrimitiveMode, vao->BaseVertex, vao->NumVertices); // Starting from the mesh's first vertex; 3 vertices -> 1 triangle
+    frame_stats.draw_calls++;
+}
 
-    // Enable Vertex Attribute 1 - Color
-    glEnableVertexAttribArray(1);
-    // Bind the VBO to use
-    glBindBuffer(GL_ARRAY_BUFFER, vao->ColorBuffer);
+void addStats (FrameStats& total, const FrameStats& frame)
+{
+    total.draw_calls += frame.draw_calls;
+    total.vao_binds += frame.vao_binds;
+    total.buffer_binds += frame.buffer_binds;
+    total.hud_quads += frame.hud_quads;
+    total.hud_draw_calls += frame.hud_draw_calls;
+    total.gl_calls_issued += frame.gl_calls_issued;
+    total.gl_calls_skipped += frame.gl_calls_skipped;
+    total.render_commands += frame.render_commands;
+    total.merged_draws += frame.merged_draws;
+    total.objects_drawn += frame.objects_drawn;
+    total.objects_culled += frame.objects_culled;
+    total.stream_bytes += frame.stream_bytes;
+    total.stream_fence_waits += frame.stream_fence_waits;
+    total.update_ms += frame.update_ms;
+    total.extract_ms += frame.extract_ms;
+    total.render_ms += frame.render_ms;
+    total.layer_redraws += frame.layer_redraws;
+}
 
-    // Draw the geometry !
-    glDrawArrays(vao->PrimitiveMode, 0, vao->NumVertices); // Starting from vertex 0; 3 vertices total -> 1 triangle
+/* Fold this frame's counters into the totals, printing averages once a second with --stats */
+void endFrameStats ()
+{
+    static double last_print = glfwGetTime();
+    static FrameStats window_stats;
+    static long long int window_frames=0;
+
+    addStats(total_stats, frame_stats);
+    addStats(window_stats, frame_stats);
+    frames_drawn++;
+    window_frames++;
+    frame_stats = FrameStats();
+
+    double now = glfwGetTime();
+    if(print_stats && now-last_print>=1)
+    {
+        printf("per frame: %.1f draw calls, %.1f VAO binds, %.1f buffer binds\n",
+               (double)window_stats.draw_calls/window_frames, (double)window_stats.vao_binds/window_frames,
+               (double)window_stats.buffer_binds/window_frames);
+        printf("per frame: %.1f HUD quads in %.1f draw calls\n",
+               (double)window_stats.hud_quads/window_frames, (double)window_stats.hud_draw_calls/window_frames);
+        printf("per frame: %.1f state calls issued, %.1f skipped\n",
+               (double)window_stats.gl_calls_issued/window_frames, (double)window_stats.gl_calls_skipped/window_frames);
+        printf("per frame: %.1f render commands, %.1f merged\n",
+               (double)window_stats.render_commands/window_frames, (double)window_stats.merged_draws/window_frames);
+        printf("per frame: %.1f objects drawn, %.1f culled\n",
+               (double)window_stats.objects_drawn/window_frames, (double)window_stats.objects_culled/window_frames);
+        printf("per frame: %.1f bytes streamed, %.1f fence waits\n",
+               (double)window_stats.stream_bytes/window_frames, (double)window_stats.stream_fence_waits/window_frames);
+        printf("per frame: %.3f ms update, %.3f ms extract, %.3f ms render\n",
+               window_stats.update_ms/window_frames, window_stats.extract_ms/window_frames, window_stats.render_ms/window_frames);
+        printf("per frame: %.2f cached layers redrawn\n", (double)window_stats.layer_redraws/window_frames);
+        window_stats = FrameStats();
+        window_frames = 0;
+        last_print = now;
+    }
+}
+
+
+/* With --stats, print the averages over the whole run once the game closes */
+void printTotalStats ()
+{
+    if(!print_stats || frames_drawn==0)
+        return;
+    printf("Average per frame: %.1f draw calls, %.1f VAO binds, %.1f buffer binds\n",
+           (double)total_stats.draw_calls/frames_drawn, (double)total_stats.vao_binds/frames_drawn,
+           (double)total_stats.buffer_binds/frames_drawn);
+    printf("Average per frame: %.1f HUD quads in %.1f draw calls\n",
+           (double)total_stats.hud_quads/frames_drawn, (double)total_stats.hud_draw_calls/frames_drawn);
+    printf("Average per frame: %.1f state calls issued, %.1f skipped\n",
+           (double)total_stats.gl_calls_issued/frames_drawn, (double)total_stats.gl_calls_skipped/frames_drawn);
+    printf("Average per frame: %.1f render commands, %.1f merged\n",
+           (double)total_stats.render_commands/frames_drawn, (double)total_stats.merged_draws/frames_drawn);
+    printf("Average per frame: %.1f objects drawn, %.1f culled\n",
+           (double)total_stats.objects_drawn/frames_drawn, (double)total_stats.objects_culled/frames_drawn);
+    printf("Average per frame: %.1f bytes streamed, %.1f fence waits\n",
+           (double)total_stats.stream_bytes/frames_drawn, (double)total_stats.stream_fence_waits/frames_drawn);
+    printf("Average per frame: %.3f ms update, %.3f ms extract, %.3f ms render\n",
+           total_stats.update_ms/frames_drawn, total_stats.extract_ms/frames_drawn, total_stats.render_ms/frames_drawn);
+    printf("Average per frame: %.2f cached layers redrawn\n", (double)total_stats.layer_redraws/frames_drawn);
+}
+
+
+/* Shared mesh registry - identical geometry is built and uploaded only once */
+struct MeshKey {
+    int shape;
+    GLfloat cx,cy,radius;
+
+    bool operator< (const MeshKey& o) const
+    {
+        const GLfloat a[] = {cx,cy,radius};
+        const GLfloat b[] = {o.cx,o.cy,o.radius};
+        if(shape!=o.shape)
+            return shape<o.shape;
+        for(int i=0;i<3;i++)
+            if(a[i]!=b[i])
+                return a[i]<b[i];
+        return false;
+    }
+};
+
+enum { MESH_CIRCLE };
+
+std::map<MeshKey, VAO*> mesh_cache;
+long long int mesh_cache_hits=0,mesh_cache_misses=0;
+
+/* Circle tables used by the game, generated at compile time */
+static constexpr geometry::Circle<360> bullet_circle(0,0,2.5);
+static constexpr geometry::Circle<360> laser_circle(15,0,2.5);
+static constexpr geometry::Circle<360> basket_circle(0,0,10);
+
+/* Return the shared mesh for this circle table, uploading it on first use. Colour is given when drawing */
+template <int N>
+VAO* getCircleMesh (const geometry::Circle<N>& circle)
+{
+    MeshKey key = {MESH_CIRCLE,circle.cx,circle.cy,circle.radius};
+    std::map<MeshKey, VAO*>::iterator it = mesh_cache.find(key);
+    if(it!=mesh_cache.end())
+    {
+        mesh_cache_hits++;
+        return it->second;
+    }
+    mesh_cache_misses++;
+    VAO* vao = create3DObject(GL_TRIANGLES,circle.vertices,circle.data,1,1,1,GL_FILL);
+    mesh_cache[key] = vao;
+    return vao;
+}
+
+void releaseMeshCache ()
+{
+    for(std::map<MeshKey, VAO*>::iterator it=mesh_cache.begin();it!=mesh_cache.end();++it)
+        delete it->second;
+    mesh_cache.clear();
 }
 
 
@@ -216,12 +884,14 @@ int exit_flag=0,start_flag=0,close_flag=0,pause_flag=0,flag_mirror=0;
 int score=0,caught=0,miss=0,hit=0,dump=0,level=1;
 long long int poi=0,f=0,poi2=0,f2=0;
 float speed_var=0;
+float rebased_speed_var=0;  // speed the live bricks' fall rates were last set for
 int mouse_pan=0;
 int max_time=40;
 int flag_shoot=0,flag_bullet=0;
 double last_update_time = glfwGetTime(), current_time;
 float brick_flag=0;
 double update_shoot = glfwGetTime(),update_bullet = glfwGetTime(),update_exit,update_mirror = glfwGetTime();
+double game_clock=0;  // seconds of unpaused play, advanced by the update thread
 double updatetime_fall = glfwGetTime(),fall_flag=0;
 float zoom=0,pan=0,pany=0;
 double xpos, ypos;
@@ -229,7 +899,482 @@ int miss_limit=10;
 
 VAO *triangle, *rectangle;
 
-glm::mat4 VP,MVP;
+glm::mat4 VP[SNAPSHOT_SLOTS];
+
+/* World rectangle the projection shows this frame, narrowed by zoom and moved by pan */
+float view_left=-100,view_right=100,view_bottom=-100,view_top=100;
+
+/* Whether an object with these world bounds can be seen; objects outside are not submitted */
+bool inView (float x0, float y0, float x1, float y1)
+{
+  if(x1<view_left || x0>view_right || y1<view_bottom || y0>view_top)
+  {
+    update_stats[update_slot].objects_culled++;
+    return false;
+  }
+  update_stats[update_slot].objects_drawn++;
+  return true;
+}
+
+/* VP lives in one uniform buffer bound to the "Camera" block of every program, uploaded once per frame */
+const GLuint CAMERA_BINDING = 0;
+GLuint camera_buffer;
+
+void createCameraBuffer ()
+{
+  camera_buffer = genBuffer();
+  glBindBuffer (GL_UNIFORM_BUFFER, camera_buffer);
+  glBufferData (GL_UNIFORM_BUFFER, sizeof(glm::mat4), NULL, GL_DYNAMIC_DRAW);
+  glBindBufferBase (GL_UNIFORM_BUFFER, CAMERA_BINDING, camera_buffer);
+}
+
+void useCameraBlock (GLuint program)
+{
+  GLuint block = glGetUniformBlockIndex(program, "Camera");
+  if(block!=GL_INVALID_INDEX)
+    glUniformBlockBinding(program, block, CAMERA_BINDING);
+}
+
+void uploadCamera ()
+{
+  glBindBuffer (GL_UNIFORM_BUFFER, camera_buffer);
+  glBufferSubData (GL_UNIFORM_BUFFER, 0, sizeof(glm::mat4), &VP[render_slot][0][0]);
+  bytes_uploaded += sizeof(glm::mat4);
+}
+
+/* Streaming buffer - per-frame data (HUD quads, brick and bullet instances, indirect draws) is appended to
+   one buffer split into STREAM_FRAMES regions. A region is fenced when its frame is done and only written
+   again once the GPU has passed that fence, so writing never waits on draws still in flight */
+enum StreamMode {
+    STREAM_PERSISTENT,      // GL 4.4 or ARB_buffer_storage : mapped once, writes are a memcpy
+    STREAM_UNSYNCHRONIZED,  // GL 3.3 : each write maps its range unsynchronized
+    STREAM_ORPHAN,          // --stream-orphan : no fences, the store is orphaned each time the regions wrap
+};
+StreamMode stream_mode=STREAM_UNSYNCHRONIZED;
+int use_stream_orphan=0;
+
+const int STREAM_FRAMES = 3;
+const GLsizeiptr STREAM_REGION_SIZE = 256*1024;  // more than a full HUD batch, brick and bullet frame together
+GLuint stream_buffer;
+GLubyte *stream_mapped=NULL;
+GLsync stream_fences[STREAM_FRAMES];
+int stream_region=0;
+GLsizeiptr stream_offset=0;  // next free byte in the current region
+
+void createStreamBuffer ()
+{
+  if(use_stream_orphan)
+    stream_mode = STREAM_ORPHAN;
+  else if(GLAD_GL_VERSION_4_4 || GLAD_GL_ARB_buffer_storage)
+    stream_mode = STREAM_PERSISTENT;
+  else
+    stream_mode = STREAM_UNSYNCHRONIZED;
+
+  // Written through the copy target so the cached array buffer binding is left alone
+  stream_buffer = genBuffer();
+  glBindBuffer (GL_COPY_WRITE_BUFFER, stream_buffer);
+  if(stream_mode==STREAM_PERSISTENT)
+  {
+    GLbitfield flags = GL_MAP_WRITE_BIT|GL_MAP_PERSISTENT_BIT|GL_MAP_COHERENT_BIT;
+    glBufferStorage (GL_COPY_WRITE_BUFFER, STREAM_FRAMES*STREAM_REGION_SIZE, NULL, flags);
+    stream_mapped = (GLubyte*)glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, STREAM_FRAMES*STREAM_REGION_SIZE, flags);
+  }
+  else
+    glBufferData (GL_COPY_WRITE_BUFFER, STREAM_FRAMES*STREAM_REGION_SIZE, NULL, GL_STREAM_DRAW);
+  for(int i=0;i<STREAM_FRAMES;i++)
+    stream_fences[i]=0;
+}
+
+void releaseStreamBuffer ()
+{
+  for(int i=0;i<STREAM_FRAMES;i++)
+    if(stream_fences[i])
+      glDeleteSync(stream_fences[i]);
+  if(stream_mapped)
+  {
+    glBindBuffer (GL_COPY_WRITE_BUFFER, stream_buffer);
+    glUnmapBuffer (GL_COPY_WRITE_BUFFER);
+    stream_mapped=NULL;
+  }
+  deleteBuffer(stream_buffer);
+}
+
+/* Fence the region just filled and move on to the next, waiting for the GPU to release it first if it has not.
+   Called once a frame after the render queue, and mid-frame if a frame outgrows its region */
+void nextStreamRegion ()
+{
+  if(stream_mode!=STREAM_ORPHAN)
+    stream_fences[stream_region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+  stream_region = (stream_region+1)%STREAM_FRAMES;
+  stream_offset = 0;
+
+  if(stream_mode==STREAM_ORPHAN)
+  {
+    if(stream_region==0)
+    {
+      glBindBuffer (GL_COPY_WRITE_BUFFER, stream_buffer);
+      glBufferData (GL_COPY_WRITE_BUFFER, STREAM_FRAMES*STREAM_REGION_SIZE, NULL, GL_STREAM_DRAW);
+    }
+    return;
+  }
+
+  GLsync fence = stream_fences[stream_region];
+  if(!fence)
+    return;
+  if(glClientWaitSync(fence, 0, 0)==GL_TIMEOUT_EXPIRED)
+  {
+    frame_stats.stream_fence_waits++;
+    while(glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000)==GL_TIMEOUT_EXPIRED)
+      ;
+  }
+  glDeleteSync(fence);
+  stream_fences[stream_region]=0;
+}
+
+/* Append size bytes to the current region and return their offset in stream_buffer */
+GLintptr streamData (const void* data, GLsizeiptr size)
+{
+  GLsizeiptr start = (stream_offset+15)&~(GLsizeiptr)15;
+  if(start+size>STREAM_REGION_SIZE)
+  {
+    nextStreamRegion();
+    start = 0;
+  }
+  GLintptr offset = stream_region*STREAM_REGION_SIZE + start;
+
+  if(stream_mode==STREAM_PERSISTENT)
+    memcpy(stream_mapped+offset, data, size);
+  else
+  {
+    glBindBuffer (GL_COPY_WRITE_BUFFER, stream_buffer);
+    if(stream_mode==STREAM_UNSYNCHRONIZED)
+    {
+      void *target = glMapBufferRange(GL_COPY_WRITE_BUFFER, offset, size,
+                                      GL_MAP_WRITE_BIT|GL_MAP_UNSYNCHRONIZED_BIT|GL_MAP_INVALIDATE_RANGE_BIT);
+      memcpy(target, data, size);
+      glUnmapBuffer (GL_COPY_WRITE_BUFFER);
+    }
+    else
+      glBufferSubData (GL_COPY_WRITE_BUFFER, offset, size, data);
+  }
+
+  stream_offset = start+size;
+  frame_stats.stream_bytes += size;
+  bytes_uploaded += size;
+  return offset;
+}
+
+/* Point instanced attributes 2 (x,y) and 3 (one float) of the bound VAO at offset in buffer.
+   Bricks, bullets and digits all use this layout */
+void pointInstanceAttributes (GLuint buffer, GLsizei stride, GLintptr offset)
+{
+  bindArrayBuffer (buffer);
+  glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, stride, (void*)offset);
+  glVertexAttribPointer(3, 1, GL_FLOAT, GL_FALSE, stride, (void*)(offset+2*sizeof(GLfloat)));
+}
+
+/* Placement of a mesh, composed in the vertex shader : tilt degrees about x, scale,
+   angle degrees about z, then move to (x,y) */
+struct Transform {
+    GLfloat x,y;
+    GLfloat angle;
+    GLfloat scale;
+    GLfloat tilt;
+};
+
+Transform place (float x, float y, float angle=0, float scale=1, float tilt=0)
+{
+  Transform transform = {x, y, angle, scale, tilt};
+  return transform;
+}
+
+/* Discs drawn as one quad with a signed-distance test in the fragment shader */
+int sdf_discs=1;
+VAO *disc_quad;
+GLuint discProgramID,DiscID,DiscTintID,DiscClipID;
+
+void createDiscQuad()
+{
+  disc_quad = createQuadObject(-1,-1,1,1,1,1,1,GL_FILL);
+}
+
+/* Render queue - objects submit commands while draw() runs, executeRenderQueue() sorts them and draws.
+   The layer keeps draw()'s painter order between groups of objects; inside a layer draws are grouped
+   by program, VAO and fill mode so neighbours share state, and with --indirect a run of them is one draw */
+enum RenderLayer {
+    LAYER_BACKGROUND,   // border and laser
+    LAYER_BULLETS,
+    LAYER_BRICKS,
+    LAYER_FOREGROUND,   // buckets and mirrors
+    LAYER_CONTROLLED,   // the bucket under control, whole over the other one
+    LAYER_HUD,
+};
+
+enum RenderProgram {
+    PROGRAM_MESH,       // programID, per-mesh transform
+    PROGRAM_DISC,       // discProgramID, centre, radii and clip
+    PROGRAM_BATCH,      // instanced and batched draws that set up their own program
+};
+
+struct RenderCommand {
+    unsigned long long key;
+    struct VAO* vao;
+    void (*batch)();    // set for PROGRAM_BATCH commands, which draw themselves
+    Transform transform;
+    GLfloat radius[2];  // discs only
+    GLfloat tint[3];
+    GLfloat clip[2];
+    int indirect_slot;  // index into this frame's indirect commands, -1 when drawn directly
+};
+
+std::vector<RenderCommand> render_queues[SNAPSHOT_SLOTS];
+
+/* layer:8 | program:8 | VAO:32 | fill mode:16, so sorting groups commands in that order of priority */
+unsigned long long renderKey (int layer, int program, GLuint vao_id, GLenum fill_mode)
+{
+    return ((unsigned long long)layer<<56) | ((unsigned long long)program<<48) |
+           ((unsigned long long)vao_id<<16) | (fill_mode&0xffff);
+}
+
+void submitCommand (const RenderCommand& command)
+{
+    render_queues[update_slot].push_back(command);
+    update_stats[update_slot].render_commands++;
+}
+
+void submit3DObject (int layer, struct VAO* vao, const Transform& transform, GLfloat red, GLfloat green, GLfloat blue)
+{
+    RenderCommand command;
+    command.key = renderKey(layer, PROGRAM_MESH, vao->VertexArrayID, vao->FillMode);
+    command.vao = vao;
+    command.batch = NULL;
+    command.transform = transform;
+    command.radius[0] = command.radius[1] = 0;
+    command.indirect_slot = -1;
+    command.tint[0] = red;
+    command.tint[1] = green;
+    command.tint[2] = blue;
+    command.clip[0] = 0;
+    command.clip[1] = 1;
+    submitCommand(command);
+}
+
+/* Same, in the object's own colour */
+void submit3DObject (int layer, struct VAO* vao, const Transform& transform)
+{
+    submit3DObject(layer, vao, transform, vao->Color[0], vao->Color[1], vao->Color[2]);
+}
+
+/* A draw that manages its own state, run at its place in the sorted queue */
+void submitBatch (int layer, void (*batch)())
+{
+    RenderCommand command;
+    command.key = renderKey(layer, PROGRAM_BATCH, 0, 0);
+    command.vao = NULL;
+    command.batch = batch;
+    command.indirect_slot = -1;
+    submitCommand(command);
+}
+
+/* Ellipse of radii (rx,ry) centred at (x,y). The fragment is kept while clip.x*local.y + clip.y >= 0 */
+void drawDisc(int layer,float x,float y,float rx,float ry,float red,float green,float blue,float clipx=0,float clipy=1)
+{
+  RenderCommand command;
+  command.key = renderKey(layer, PROGRAM_DISC, disc_quad->VertexArrayID, disc_quad->FillMode);
+  command.vao = disc_quad;
+  command.batch = NULL;
+  command.transform = place(x,y);
+  command.radius[0] = rx;
+  command.radius[1] = ry;
+  command.indirect_slot = -1;
+  command.tint[0] = red;
+  command.tint[1] = green;
+  command.tint[2] = blue;
+  command.clip[0] = clipx;
+  command.clip[1] = clipy;
+  submitCommand(command);
+}
+
+/* Indirect path (--indirect, needs GL 4.3) - every queued mesh in the static buffer becomes one command
+   in a per-frame indirect buffer, and reads its transform and tint as instance attributes picked by the
+   command's baseInstance. A run of them is then one glMultiDraw*Indirect however many objects it holds */
+int use_indirect=0;
+GLuint indirectProgramID,indirect_vao;
+GLintptr indirect_arrays_offset,indirect_elements_offset;  // where this frame's commands were streamed
+
+struct DrawArraysIndirectCommand {
+    GLuint count,instanceCount,first,baseInstance;
+};
+
+struct DrawElementsIndirectCommand {
+    GLuint count,instanceCount,firstIndex;
+    GLint baseVertex;
+    GLuint baseInstance;
+};
+
+struct DrawParams {
+    GLfloat transform[4];   // x, y, angle, scale
+    GLfloat tint[3];
+    GLfloat tilt;
+};
+
+std::vector<DrawArraysIndirectCommand> indirect_arrays;
+std::vector<DrawElementsIndirectCommand> indirect_elements;
+std::vector<DrawParams> draw_params;
+
+/* Point the per-draw parameters (attributes 4 and 5) of the bound indirect VAO at offset in the streaming buffer */
+void pointDrawParams (GLintptr offset)
+{
+  bindArrayBuffer (stream_buffer);
+  glVertexAttribPointer(4, 4, GL_FLOAT, GL_FALSE, sizeof(DrawParams), (void*)(offset+offsetof(DrawParams, transform)));
+  glVertexAttribPointer(5, 4, GL_FLOAT, GL_FALSE, sizeof(DrawParams), (void*)(offset+offsetof(DrawParams, tint)));
+}
+
+/* Second VAO over the static buffer with the per-draw parameters as instanced attributes 4 and 5 */
+void createIndirectVAO ()
+{
+  indirect_vao = genVertexArray();
+  bindVertexArray (indirect_vao);
+  pointStaticAttributes();
+  bindQuadIndexBuffer();
+
+  pointDrawParams(0);
+  glVertexAttribDivisor(4, 1);
+  glVertexAttribDivisor(5, 1);
+  glEnableVertexAttribArray(4);
+  glEnableVertexAttribArray(5);
+}
+
+void releaseIndirectVAO ()
+{
+  deleteVertexArray(indirect_vao);
+}
+
+bool drawnIndirect (const RenderCommand& command)
+{
+  return use_indirect && !command.batch && (command.key>>48&0xff)==PROGRAM_MESH &&
+         static_vao!=0 && command.vao->VertexArrayID==static_vao;
+}
+
+/* Fill and upload the frame's indirect commands and draw parameters from the sorted queue */
+void uploadIndirectCommands ()
+{
+  std::vector<RenderCommand>& render_queue = render_queues[render_slot];
+  indirect_arrays.clear();
+  indirect_elements.clear();
+  draw_params.clear();
+  for(size_t i=0;i<render_queue.size();i++)
+  {
+    RenderCommand& command = render_queue[i];
+    command.indirect_slot = -1;
+    if(!drawnIndirect(command))
+      continue;
+
+    const Transform& t = command.transform;
+    DrawParams params = {{t.x, t.y, t.angle, t.scale}, {command.tint[0], command.tint[1], command.tint[2]}, t.tilt};
+    GLuint instance = draw_params.size();
+    draw_params.push_back(params);
+
+    struct VAO* vao = command.vao;
+    if(vao->NumIndices>0)
+    {
+      DrawElementsIndirectCommand draw = {(GLuint)vao->NumIndices, 1, 0, vao->BaseVertex, instance};
+      command.indirect_slot = indirect_elements.size();
+      indirect_elements.push_back(draw);
+    }
+    else
+    {
+      DrawArraysIndirectCommand draw = {(GLuint)vao->NumVertices, 1, (GLuint)vao->BaseVertex, instance};
+      command.indirect_slot = indirect_arrays.size();
+      indirect_arrays.push_back(draw);
+    }
+  }
+  if(draw_params.empty())
+    return;
+
+  // Parameters and commands both go to the streaming buffer, which doubles as the indirect buffer
+  GLintptr params_offset = streamData(&draw_params[0], draw_params.size()*sizeof(DrawParams));
+  bindVertexArray (indirect_vao);
+  pointDrawParams(params_offset);
+
+  if(!indirect_arrays.empty())
+    indirect_arrays_offset = streamData(&indirect_arrays[0], indirect_arrays.size()*sizeof(DrawArraysIndirectCommand));
+  if(!indirect_elements.empty())
+    indirect_elements_offset = streamData(&indirect_elements[0], indirect_elements.size()*sizeof(DrawElementsIndirectCommand));
+  glBindBuffer (GL_DRAW_INDIRECT_BUFFER, stream_buffer);
+}
+
+/* Draw the run of indirect commands starting at render_queue[first] with one call, returning the index after it */
+size_t drawIndirectRun (size_t first)
+{
+  const std::vector<RenderCommand>& render_queue = render_queues[render_slot];
+  const RenderCommand& command = render_queue[first];
+  bool indexed = command.vao->NumIndices>0;
+  size_t next = first+1;
+  while(next<render_queue.size() && render_queue[next].key==command.key && render_queue[next].indirect_slot>=0 &&
+        (render_queue[next].vao->NumIndices>0)==indexed && render_queue[next].vao->PrimitiveMode==command.vao->PrimitiveMode)
+    next++;
+
+  useProgram (indirectProgramID,-1);
+  setPolygonMode (command.vao->FillMode);
+  bindVertexArray (indirect_vao);
+  GLsizei count = next-first;
+  if(indexed)
+  {
+    size_t offset = indirect_elements_offset + command.indirect_slot*sizeof(DrawElementsIndirectCommand);
+    glMultiDrawElementsIndirect(command.vao->PrimitiveMode, GL_UNSIGNED_SHORT, (void*)offset, count, 0);
+  }
+  else
+  {
+    size_t offset = indirect_arrays_offset + command.indirect_slot*sizeof(DrawArraysIndirectCommand);
+    glMultiDrawArraysIndirect(command.vao->PrimitiveMode, (void*)offset, count, 0);
+  }
+  frame_stats.draw_calls++;
+  frame_stats.merged_draws += count-1;
+  return next;
+}
+
+/* Sort the frame's commands and draw them. The sort is stable, so equal keys keep their submission order.
+   The queue is left as it is, since the same snapshot is drawn again if no newer one is ready */
+void executeRenderQueue ()
+{
+  std::vector<RenderCommand>& render_queue = render_queues[render_slot];
+  std::stable_sort(render_queue.begin(), render_queue.end(),
+                   [](const RenderCommand& a, const RenderCommand& b) { return a.key<b.key; });
+  if(use_indirect)
+    uploadIndirectCommands();
+
+  for(size_t i=0;i<render_queue.size();)
+  {
+    const RenderCommand& command = render_queue[i];
+    if(command.batch)
+    {
+      command.batch();
+      i++;
+      continue;
+    }
+    if(use_indirect && command.indirect_slot>=0)
+    {
+      i = drawIndirectRun(i);
+      continue;
+    }
+
+    if((command.key>>48&0xff)==PROGRAM_DISC)
+    {
+      useProgram (discProgramID,DiscTintID);
+      glUniform4f(DiscID,command.transform.x,command.transform.y,command.radius[0],command.radius[1]);
+      glUniform2f(DiscClipID,command.clip[0],command.clip[1]);
+    }
+    else
+    {
+      useProgram (programID,Matrices.TintID);
+      glUniform4f(Matrices.TransformID,command.transform.x,command.transform.y,command.transform.angle,command.transform.scale);
+      glUniform1f(Matrices.TiltID,command.transform.tilt);
+    }
+    draw3DObject(command.vao, command.tint[0], command.tint[1], command.tint[2]);
+    i++;
+  }
+}
 
 
 class Mirror{
@@ -241,44 +1386,24 @@ class Mirror{
 public: 
 ~Mirror()
 {
-  free(mirror);
+  destroyMeshes();
+}
+void destroyMeshes()
+{
+  delete mirror;
+  mirror=NULL;
 }  
 void createMirror()
 {
-  static const GLfloat vertex_buffer_data [] = {
-    -10,-0.5,0,
-    -10,0.5,0,
-    10,0.5,0,
-
-    10,0.5,0,
-    10,-0.5,0,
-    -10,-0.5,0,
-
-  };
-
-  static const GLfloat color_buffer_data [] = {
-    0.5,0.5,0.5,
-    0.5,0.5,0.5,
-    0.5,0.5,0.5,
-
-    0.5,0.5,0.5,
-    0.5,0.5,0.5,
-    0.5,0.5,0.5,
-  };
-
-  mirror= create3DObject(GL_TRIANGLES,6,vertex_buffer_data,color_buffer_data,GL_FILL);
+  mirror= createQuadObject(-10,-0.5,10,0.5,0.5,0.5,0.5,GL_FILL);
 
 }
 
-void drawMirror()
+void extract()
 {
-  Matrices.model = glm::mat4(1.0f);
-  glm::mat4 transMirror = glm::translate (glm::vec3(x,y,0));
-  glm::mat4 rotateMirror = glm::rotate((float)(rotation*M_PI/180.0f), glm::vec3(0,0,1));
-  Matrices.model *=transMirror*rotateMirror;
-  MVP= VP * Matrices.model;
-  glUniformMatrix4fv(Matrices.MatrixID,1,GL_FALSE,&MVP[0][0]);
-  draw3DObject(mirror); 
+  // 20x1 bar turned about its centre stays within 10.5 of it
+  if(inView(x-10.5,y-10.5,x+10.5,y+10.5))
+    submit3DObject(LAYER_FOREGROUND,mirror,place(x,y,rotation));
 
 }
 
@@ -289,7 +1414,7 @@ void drawMirror()
 class Lasers {
 
 public:
-VAO *laser,*laser2,*lasercirc,*laser_click;
+VAO *laser,*laser2,*lasercirc;
 float laser_rot_dir,lasery_dir,l2x,l2y,laser_rot,lasery;
 bool laser_rot_status,lasery_status;
 int mouse_flag;
@@ -308,10 +1433,14 @@ Lasers()
 }
 ~Lasers()
 {
-  free(laser);
-  free(laser2);
-  free(lasercirc);
-  free(laser_click);
+  destroyMeshes();
+}
+void destroyMeshes()
+{
+  // lasercirc belongs to the mesh cache
+  delete laser;
+  delete laser2;
+  laser=laser2=NULL;
 }
 void createLaser()
 {
@@ -327,28 +1456,7 @@ void createLaser()
  
   };
 
-  static const GLfloat color_buffer_data [] = {
-    0,0,0.57,
-    0,0,0.57,
-    0,0,0.57,
-
-    0,0,0.57,
-    0,0,0.57,
-    0,0,0.57,
-
-  };
-  static const GLfloat color_buffer_data1 [] = {
-    0,0,0.2,
-    0,0,0.2,
-    0,0,0.2,
-
-    0,0,0.2,
-    0,0,0.2,
-    0,0,0.2,
-
-  };
-  laser = create3DObject(GL_TRIANGLES,6,vertex_buffer_data,color_buffer_data,GL_FILL);
-  laser_click = create3DObject(GL_TRIANGLES,6,vertex_buffer_data,color_buffer_data1,GL_FILL);
+  laser = create3DObject(GL_TRIANGLES,6,vertex_buffer_data,0,0,0.57,GL_FILL);
 }
 void checkClick(double x,double y)
 {
@@ -368,74 +1476,16 @@ void createLaser2()
 {
   l2x=-95;
   l2y=15;
-  static const GLfloat vertex_buffer_data [] = {
- 
-    0,-2.5,0,
-    0,2.5,0,
-    15,2.5,0,
-
-    15,2.5,0,
-    15,-2.5,0,
-    0,-2.5,0,
-
-  };
-
-  static const GLfloat color_buffer_data [] ={
-
-    0,0,0.9,
-    0,0,0.9,
-    0,0,0.9,
-
-    0,0,0.9,
-    0,0,0.9,
-    0,0,0.9,
-
-  };
-  laser2= create3DObject(GL_TRIANGLES,6,vertex_buffer_data,color_buffer_data,GL_FILL);
+  laser2= createQuadObject(0,-2.5,15,2.5,0,0,0.9,GL_FILL);
 
 }
 
 void createlasercirc()
 {
-  float radius=2.5;
-  static GLfloat vertex_buffer_data [360*9];
-  for(int i=0;i<360;i++)
-  {
-    vertex_buffer_data[9*i]=15;
-    vertex_buffer_data[9*i+1]=0;
-    vertex_buffer_data[9*i+2]=0;
-
-    vertex_buffer_data[9*i+3]=15+radius*cos(i*M_PI/180);
-    vertex_buffer_data[9*i+4]=radius*sin(i*M_PI/180);
-    vertex_buffer_data[9*i+5]=0;
-
-    vertex_buffer_data[9*i+6]=15+radius*cos(((i+1)%360)*M_PI/180);
-    vertex_buffer_data[9*i+7]=radius*sin(((i+1)%360)*M_PI/180);
-    vertex_buffer_data[9*i+8]=0;
-
-  }
-
-  static GLfloat color_buffer_data [360*9];
-  for(int i=0;i<360;i++)
-  {
-    color_buffer_data[9*i]=0;
-    color_buffer_data[9*i+1]=0;
-    color_buffer_data[9*i+2]=0.9;
-
-    color_buffer_data[9*i+3]=0;
-    color_buffer_data[9*i+4]=0;
-    color_buffer_data[9*i+5]=0.9;
-
-    color_buffer_data[9*i+6]=0;
-    color_buffer_data[9*i+7]=0;
-    color_buffer_data[9*i+8]=0.9;
-
-  }
-  lasercirc= create3DObject(GL_TRIANGLES,360*3,vertex_buffer_data,color_buffer_data,GL_FILL);
-
+  lasercirc = getCircleMesh(laser_circle);
 }
 
-void draw()
+void move()
 {
   if(lasery_dir==1 && lasery+30<75)
   {
@@ -454,38 +1504,25 @@ void draw()
   {
       laser_rot-=1*laser_rot_status;
   }
+}
 
-  glm::mat4 transLaser1 = glm::translate (glm::vec3(0,lasery,0));
-  Matrices.model = glm::mat4(1.0f);
-  Matrices.model *= transLaser1;
-  MVP = VP * Matrices.model;
-  glUniformMatrix4fv(Matrices.MatrixID,1,GL_FALSE,&MVP[0][0]);
+void extract()
+{
   if(mouse_flag==0)
-    draw3DObject(laser);
+    submit3DObject(LAYER_BACKGROUND,laser,place(0,lasery));
   else
-    draw3DObject(laser_click);
-
-  Matrices.model = glm::mat4(1.0f);
-  glm::mat4 transLaser2 = glm::translate (glm::vec3(l2x,l2y+lasery,0));
-  glm::mat4 rotateLaser2 = glm::rotate((float)(laser_rot*M_PI/180.0f), glm::vec3(0,0,1)); 
-  Matrices.model *= transLaser2 * rotateLaser2;
-  MVP = VP * Matrices.model;
-  glUniformMatrix4fv(Matrices.MatrixID,1,GL_FALSE,&MVP[0][0]);
-  draw3DObject(laser2);
-
-  Matrices.model = glm::mat4(1.0f);
-  glm::mat4 transLasercirc = glm::translate (glm::vec3(l2x,l2y+lasery,0));
-  glm::mat4 rotateLasercirc = glm::rotate((float)(laser_rot*M_PI/180.0f), glm::vec3(0,0,1)); 
-  Matrices.model *= transLasercirc * rotateLasercirc;
-  MVP = VP * Matrices.model;
-  glUniformMatrix4fv(Matrices.MatrixID,1,GL_FALSE,&MVP[0][0]);
-  draw3DObject(lasercirc);
-  Matrices.model = glm::mat4(1.0f);
-  glm::mat4 transLasercirc2= glm::translate (glm::vec3(l2x-15,l2y+lasery,0));
-  Matrices.model *= transLasercirc2 ;
-  MVP = VP * Matrices.model;
-  glUniformMatrix4fv(Matrices.MatrixID,1,GL_FALSE,&MVP[0][0]);
-  draw3DObject(lasercirc);
+    submit3DObject(LAYER_BACKGROUND,laser,place(0,lasery),0,0,0.2);
+
+  submit3DObject(LAYER_BACKGROUND,laser2,place(l2x,l2y+lasery,laser_rot));
+
+  if(sdf_discs)
+  {
+    drawDisc(LAYER_BACKGROUND,l2x+15*cos(laser_rot*M_PI/180.0f),l2y+lasery+15*sin(laser_rot*M_PI/180.0f),2.5,2.5,0,0,0.9);
+    drawDisc(LAYER_BACKGROUND,l2x,l2y+lasery,2.5,2.5,0,0,0.9);
+    return;
+  }
+  submit3DObject(LAYER_BACKGROUND,lasercirc,place(l2x,l2y+lasery,laser_rot),0,0,0.9);
+  submit3DObject(LAYER_BACKGROUND,lasercirc,place(l2x-15,l2y+lasery),0,0,0.9);
 
 }
 
@@ -497,7 +1534,7 @@ public:
 float bx,bx_dir,bcx,bcy,extra;
 bool bx_status;
 int mouse_flag;
-VAO *basket,*bask_circ,*basket_click;
+VAO *basket,*bask_circ;
 
 public:
   Buckets()
@@ -509,258 +1546,524 @@ public:
   }
   ~Buckets()
   {
-    free(basket);
-    free(bask_circ);
-    free(basket_click);
+    destroyMeshes();
+  }
+  void destroyMeshes()
+  {
+    // bask_circ belongs to the mesh cache
+    delete basket;
+    basket=NULL;
   }
 void createBaskRect()
 {
-  static const GLfloat vertex_buffer_data[] = {
-      -60,-95,0,
-      -60,-70,0,
-      -40,-70,0,
-
-      -40,-70,0,
-      -40,-95,0,
-      -60,-95,0,
-  };
-  static const GLfloat color_buffer_data[] = {
-    1,0,0,
-    1,0,0,
-    1,0,0,
-
-    1,0,0,
-    1,0,0,
-    1,0,0,
-  };
-
-  static const GLfloat color_buffer_data2[] = {
-    0,1,0,
-    0,1,0,
-    0,1,0,
+  if(extra==0)
+    basket = createQuadObject(-60,-95,-40,-70,1,0,0,GL_FILL);
+  else
+    basket = createQuadObject(-60,-95,-40,-70,0,1,0,GL_FILL);
+}
 
-    0,1,0,
-    0,1,0,
-    0,1,0,
-  };
-  static const GLfloat color_buffer_data1[] = {
-    0.4,0,0,
-    0.4,0,0,
-    0.4,0,0,
-
-    0.4,0,0,
-    0.4,0,0,
-    0.4,0,0,
-  };
 
-  static const GLfloat color_buffer_data3[] = {
-    0,0.4,0,
-    0,0.4,0,
-    0,0.4,0,
+void checkClick(double x,double y)
+{
+  if(bx+extra-61<=x && bx+extra-39>=x)
+  {
+    if(-97<=y && y<=-68)
+    {
+      mouse_flag=1;
+    }
+    else
+      mouse_flag=0;
+  }
+  else
+    mouse_flag=0;
+}
 
-    0,0.4,0,
-    0,0.4,0,
-    0,0.4,0,
-  };
+void createBaskCirc()
+{
   if(extra==0)
   {
-  basket = create3DObject(GL_TRIANGLES,6,vertex_buffer_data,color_buffer_data,GL_FILL);
-  basket_click = create3DObject(GL_TRIANGLES,6,vertex_buffer_data,color_buffer_data1,GL_FILL);
+  bcx=-50;
+  bcy=-70;
   }
   else
   {
-    basket = create3DObject(GL_TRIANGLES,6,vertex_buffer_data,color_buffer_data2,GL_FILL);
-    basket_click = create3DObject(GL_TRIANGLES,6,vertex_buffer_data,color_buffer_data3,GL_FILL);
+  bcx=30;
+  bcy=-70;
   }
+
+  bask_circ = getCircleMesh(basket_circle);
+
 }
 
+void move()
+{
+
+  if(bx_dir==-1 && bx-60+extra>=-69)
+  {
+      bx-=1*bx_status;
+  }
+  else if(bx_dir==1 && bx-40+extra<=49)
+  {
+      bx+=1*bx_status;
+  }
+}
 
-void checkClick(double x,double y)
+void extract(int layer)
 {
-  if(bx+extra-61<=x && bx+extra-39>=x)
+  // The radius-10 rims span the basket's 20 unit width; squashed, they stand under 2 units above and
+  // below its -95..-70 ends, so the bounds are the -97..-68 that checkClick() uses
+  if(!inView(bx+extra-60,-97,bx+extra-40,-68))
+    return;
+
+  if(mouse_flag==0)
+    submit3DObject(layer,basket,place(bx+extra,0));
+  else
+    submit3DObject(layer,basket,place(bx+extra,0),0.4*basket->Color[0],0.4*basket->Color[1],0.4*basket->Color[2]);
+
+
+  if(sdf_discs)
   {
-    if(-97<=y && y<=-68)
+    // The mesh rims are circles tipped 80 degrees about X; the half that swings
+    // behind the near plane (z > 2.9) is clipped, which gives the bucket its shape
+    float squash = cos(80*M_PI/180.0f), near_clip = 2.9/(10*sin(80*M_PI/180.0f));
+    if(extra==0)
     {
-      mouse_flag=1;
+      drawDisc(layer,bcx+bx,bcy,10,10*squash,1,0.4,0.4,1,near_clip);
+      drawDisc(layer,bcx+bx,bcy-25,10,10*squash,1,0.4,0.4,-1,near_clip);
     }
     else
-      mouse_flag=0;
+    {
+      drawDisc(layer,bcx+bx,bcy,10,10*squash,0.4,1,0.4,1,near_clip);
+      drawDisc(layer,bcx+bx,bcy-25,10,10*squash,0.4,1,0.4,-1,near_clip);
+    }
+    return;
   }
+
+  if(extra==0)
+    submit3DObject(layer,bask_circ,place(bcx+bx,bcy,0,1,-80),1,0.4,0.4);
   else
-    mouse_flag=0;
+    submit3DObject(layer,bask_circ,place(bcx+bx,bcy,0,1,-80),0.4,1,0.4);
+  if(extra==0)
+    submit3DObject(layer,bask_circ,place(bcx+bx,bcy-25,0,1,80),1,0.4,0.4);
+  else
+    submit3DObject(layer,bask_circ,place(bcx+bx,bcy-25,0,1,80),0.4,1,0.4);
+
+}
+
+}bucket[2];
+
+/* HUD pieces : a black seven-segment bar and the blue box behind the counters */
+constexpr geometry::IndexedQuad segment_quad(-2,-0.5,2,0.5);
+constexpr geometry::IndexedQuad box_quad(-7,-5,7,5);
+
+/* HUD batcher - draw_rect and friends queue quads already moved into world space,
+   flushBatch() draws everything queued with one call */
+struct BatchVertex {
+    GLfloat x,y,z;
+    GLfloat r,g,b;
+};
+
+const int MAX_BATCH_QUADS = 512;
+constexpr geometry::QuadIndices<MAX_BATCH_QUADS> batch_indices;
+BatchVertex batch_vertices[SNAPSHOT_SLOTS][MAX_BATCH_QUADS*4];
+int num_batch_quads[SNAPSHOT_SLOTS];
+GLuint batch_vao,batch_index_buffer;
+
+/* Point the batch VAO's position and colour at vertices streamed to offset */
+void pointBatchAttributes (GLintptr offset)
+{
+  bindArrayBuffer (stream_buffer);
+  glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(BatchVertex), (void*)offset);
+  glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(BatchVertex), (void*)(offset+3*sizeof(GLfloat)));
+}
+
+void createBatch()
+{
+  batch_vao = genVertexArray();
+  bindVertexArray (batch_vao);
+
+  pointBatchAttributes(0);
+  glEnableVertexAttribArray(0);
+  glEnableVertexAttribArray(1);
+
+  batch_index_buffer = genBuffer();
+  glBindBuffer (GL_ELEMENT_ARRAY_BUFFER, batch_index_buffer);
+  glBufferData (GL_ELEMENT_ARRAY_BUFFER, sizeof(batch_indices.data), batch_indices.data, GL_STATIC_DRAW);
+  bytes_uploaded += sizeof(batch_indices.data);
+}
+
+void releaseBatch()
+{
+  deleteVertexArray(batch_vao);
+  deleteBuffer(batch_index_buffer);
 }
 
-void createBaskCirc()
+void flushBatch()
 {
-  if(extra==0)
+  int quads=num_batch_quads[render_slot];
+  if(quads==0)
+    return;
+
+  // Vertices are already in world space, so the transform is identity
+  useProgram (programID,Matrices.TintID);
+  glUniform4f(Matrices.TransformID,0,0,0,1);
+  glUniform1f(Matrices.TiltID,0);
+  setTint(1,1,1);
+  setPolygonMode (GL_FILL);
+
+  GLintptr offset = streamData(batch_vertices[render_slot], quads*4*sizeof(BatchVertex));
+
+  // Quads are drawn in the order they were queued, so later ones still cover earlier ones
+  bindVertexArray (batch_vao);
+  pointBatchAttributes(offset);
+  glDrawElements(GL_TRIANGLES, quads*6, GL_UNSIGNED_SHORT, (void*)0);
+  frame_stats.draw_calls++;
+  frame_stats.hud_draw_calls++;
+}
+
+/* Queue quad rotated by rotation degrees and moved to (x,y) */
+void batchQuad(const geometry::IndexedQuad& quad,float x,float y,float rotation,float red,float green,float blue)
+{
+  // Drawing is left to the render thread, so a full batch drops further quads instead of flushing
+  if(num_batch_quads[update_slot]>=MAX_BATCH_QUADS)
+    return;
+
+  float c=cos(rotation*M_PI/180.0f),s=sin(rotation*M_PI/180.0f);
+  BatchVertex *v=&batch_vertices[update_slot][4*num_batch_quads[update_slot]];
+  for(int i=0;i<4;i++)
   {
-  bcx=-50;
-  bcy=-70;
+    float px=quad.data[3*i],py=quad.data[3*i+1];
+    v[i].x=x+c*px-s*py;
+    v[i].y=y+s*px+c*py;
+    v[i].z=0;
+    v[i].r=red;
+    v[i].g=green;
+    v[i].b=blue;
   }
-  else
+
+  float x0=v[0].x,x1=v[0].x,y0=v[0].y,y1=v[0].y;
+  for(int i=1;i<4;i++)
   {
-  bcx=30;
-  bcy=-70;
+    x0=std::min(x0,v[i].x);
+    x1=std::max(x1,v[i].x);
+    y0=std::min(y0,v[i].y);
+    y1=std::max(y1,v[i].y);
   }
+  if(!inView(x0,y0,x1,y1))
+    return;
+  num_batch_quads[update_slot]++;
+  update_stats[update_slot].hud_quads++;
+}
 
-  float radius=10;
-  static GLfloat vertex_buffer_data [360*9];
-  for(int i=0;i<360;i++)
-  {
-    vertex_buffer_data[9*i]=0;
-    vertex_buffer_data[9*i+1]=0;
-    vertex_buffer_data[9*i+2]=0;
+/* Bricks are drawn instanced : one shared quad, one instance record per live brick */
+struct BrickInstance {
+    GLfloat x,y;
+    GLfloat color;   // index into the brick palette (Bricks::val2)
+};
 
-    vertex_buffer_data[9*i+3]=radius*cos(i*M_PI/180);
-    vertex_buffer_data[9*i+4]=radius*sin(i*M_PI/180);
-    vertex_buffer_data[9*i+5]=0;
+/* Brick colours by Bricks::val2 : black, red, green */
+const GLfloat brick_palette [] = {
+  0,0,0,
+  1,0,0,
+  0,1,0,
+};
 
-    vertex_buffer_data[9*i+6]=radius*cos(((i+1)%360)*M_PI/180);
-    vertex_buffer_data[9*i+7]=radius*sin(((i+1)%360)*M_PI/180);
-    vertex_buffer_data[9*i+8]=0;
+VAO *brick_quad;
+GLuint brickProgramID,BrickPaletteID;
+BrickInstance brick_instances[SNAPSHOT_SLOTS][1000];
+int num_brick_instances[SNAPSHOT_SLOTS];
 
-  }
+void createBrickQuad()
+{
+  brick_quad = createQuadObject(-1.5,0,1.5,7,1,1,1,GL_FILL);
+
+  // Per-instance attributes are streamed each frame, advanced once per brick
+  bindVertexArray (brick_quad->VertexArrayID);
+  pointInstanceAttributes(stream_buffer, sizeof(BrickInstance), 0);
+  glVertexAttribDivisor(2, 1);
+  glVertexAttribDivisor(3, 1);
+  glEnableVertexAttribArray(2);
+  glEnableVertexAttribArray(3);
+}
+
+void addBrickInstance(float x,float y,int color)
+{
+  int& count=num_brick_instances[update_slot];
+  if(count>=1000 || !inView(x-1.5,y,x+1.5,y+7))
+    return;
+  brick_instances[update_slot][count].x=x;
+  brick_instances[update_slot][count].y=y;
+  brick_instances[update_slot][count].color=color;
+  count++;
+}
 
-  static GLfloat color_buffer_data [360*9];
-  for(int i=0;i<360;i++)
+/* Draw every brick collected this frame with a single instanced call */
+void drawBricks()
+{
+  int count=num_brick_instances[render_slot];
+  if(count>0)
   {
-    color_buffer_data[9*i]=1;
-    color_buffer_data[9*i+1]=0.4;
-    color_buffer_data[9*i+2]=0.4;
+    useProgram (brickProgramID,-1);
 
-    color_buffer_data[9*i+3]=1;
-    color_buffer_data[9*i+4]=0.4;
-    color_buffer_data[9*i+5]=0.4;
+    GLintptr offset = streamData(brick_instances[render_slot], count*sizeof(BrickInstance));
 
-    color_buffer_data[9*i+6]=1;
-    color_buffer_data[9*i+7]=0.4;
-    color_buffer_data[9*i+8]=0.4;
+    setPolygonMode (brick_quad->FillMode);
+    bindVertexArray (brick_quad->VertexArrayID);
+    pointInstanceAttributes(stream_buffer, sizeof(BrickInstance), offset);
+    glDrawElementsInstanced(brick_quad->PrimitiveMode, brick_quad->NumIndices, GL_UNSIGNED_SHORT, (void*)0, count);
+    frame_stats.draw_calls++;
 
+    useProgram (programID,Matrices.TintID);
   }
+}
 
-  static GLfloat color_buffer_data2 [360*9];
-  for(int i=0;i<360;i++)
-  {
-    color_buffer_data2[9*i]=0.4;
-    color_buffer_data2[9*i+1]=1;
-    color_buffer_data2[9*i+2]=0.4;
-
-    color_buffer_data2[9*i+3]=0.4;
-    color_buffer_data2[9*i+4]=1;
-    color_buffer_data2[9*i+5]=0.4;
-
-    color_buffer_data2[9*i+6]=0.4;
-    color_buffer_data2[9*i+7]=1;
-    color_buffer_data2[9*i+8]=0.4;
+/* --gpu-bricks : bricks fall in the vertex shader from what they were given at spawn. The table holds one
+   record per ring slot of block[], written only when a brick spawns, changes speed or goes away, and only
+   the records written since the last upload are sent to the GPU */
+struct BrickSpawn {
+    GLfloat x,y0,t0,rate;   // y = y0 - rate*(time - t0), both times counted from fall_origin
+    GLfloat color;          // palette index, -1 for an empty slot
+};
 
+/* Times go to the GPU as floats, so they are kept small by counting them from a recent game_clock.
+   The origin moves on every FALL_ORIGIN_PERIOD seconds, and the live bricks are rebased onto it */
+const double FALL_ORIGIN_PERIOD = 256;
+double fall_origin=0;
+double fall_origins[SNAPSHOT_SLOTS];    // fall_origin of the tick each slot holds
+
+int gpu_bricks=0;
+VAO *falling_brick_quad;
+GLuint FallingBrickBuffer;
+GLuint fallingBrickProgramID,FallingBrickTimeID;
+BrickSpawn brick_spawns[1000];          // kept by the update thread
+int brick_spawns_lo=0,brick_spawns_hi=0;                            // records written during this tick
+int brick_missing_lo[SNAPSHOT_SLOTS],brick_missing_hi[SNAPSHOT_SLOTS];  // records each slot's copy lacks
+int brick_spawns_version=0;             // bumped by each tick that wrote records
+int brick_version_lo=0,brick_version_hi=0;                          // the records that tick wrote
+BrickSpawn brick_tables[SNAPSHOT_SLOTS][1000];
+int brick_table_versions[SNAPSHOT_SLOTS],brick_table_slots[SNAPSHOT_SLOTS];
+int brick_table_lo[SNAPSHOT_SLOTS],brick_table_hi[SNAPSHOT_SLOTS];
+int uploaded_brick_version=0;
+
+/* Grow the record range [lo,hi) to take in record i; an empty range has hi<=lo */
+void widenRange(int& lo,int& hi,int i)
+{
+  if(hi<=lo)
+  {
+    lo=i;
+    hi=i+1;
+    return;
   }
-  if(extra==0)
-  bask_circ= create3DObject(GL_TRIANGLES,360*3,vertex_buffer_data,color_buffer_data,GL_FILL);
-  else
-  bask_circ= create3DObject(GL_TRIANGLES,360*3,vertex_buffer_data,color_buffer_data2,GL_FILL);
+  lo=std::min(lo,i);
+  hi=std::max(hi,i+1);
+}
 
+/* Distance a brick drops per fall step, over the time between steps on the CPU path. The fall timer is
+   only checked once per update tick, so a step comes on the first tick at or after its period */
+float brickFallRate()
+{
+  double step_period=ceil((0.075-speed_var*0.001)*UPDATE_RATE)/UPDATE_RATE;
+  return (1.5+0.2*speed_var)/step_period;
 }
 
-void draw()
+void createFallingBrickQuad()
 {
+  falling_brick_quad = createQuadObject(-1.5,0,1.5,7,1,1,1,GL_FILL);
+
+  bindVertexArray (falling_brick_quad->VertexArrayID);
+  FallingBrickBuffer = genBuffer();
+  bindArrayBuffer (FallingBrickBuffer);
+  glBufferData (GL_ARRAY_BUFFER, sizeof(brick_spawns), NULL, GL_DYNAMIC_DRAW);
+  glVertexAttribPointer(2, 4, GL_FLOAT, GL_FALSE, sizeof(BrickSpawn), (void*)0);
+  glVertexAttribPointer(3, 1, GL_FLOAT, GL_FALSE, sizeof(BrickSpawn), (void*)offsetof(BrickSpawn, color));
+  glVertexAttribDivisor(2, 1);
+  glVertexAttribDivisor(3, 1);
+  glEnableVertexAttribArray(2);
+  glEnableVertexAttribArray(3);
+}
 
-  if(bx_dir==-1 && bx-60+extra>=-69)
-  {
-      bx-=1*bx_status;
-  }
-  else if(bx_dir==1 && bx-40+extra<=49)
+/* Draw every brick from the snapshot's spawn table, uploading what changed since the last upload first.
+   The snapshot knows the records its own version wrote; when the renderer skipped a version in between,
+   the whole table goes up instead */
+void drawFallingBricks()
+{
+  int slots=brick_table_slots[render_slot];
+  if(slots==0)
+    return;
+
+  int version=brick_table_versions[render_slot];
+  if(version!=uploaded_brick_version)
   {
-      bx+=1*bx_status;
+    int lo=0,hi=slots;
+    if(version==uploaded_brick_version+1)
+    {
+      lo=brick_table_lo[render_slot];
+      hi=brick_table_hi[render_slot];
+    }
+    if(hi>lo)
+    {
+      bindArrayBuffer (FallingBrickBuffer);
+      glBufferSubData (GL_ARRAY_BUFFER, lo*sizeof(BrickSpawn), (hi-lo)*sizeof(BrickSpawn), brick_tables[render_slot]+lo);
+      bytes_uploaded += (hi-lo)*sizeof(BrickSpawn);
+    }
+    uploaded_brick_version=version;
   }
 
-  glm::mat4 transBask1 = glm::translate (glm::vec3(bx+extra,0,0));
-  Matrices.model = glm::mat4(1.0f);
-  Matrices.model *= transBask1;
-  MVP = VP * Matrices.model;
-  glUniformMatrix4fv(Matrices.MatrixID,1,GL_FALSE,&MVP[0][0]);
-  if(mouse_flag==0)
-    draw3DObject(basket);
-  else
-    draw3DObject(basket_click);
-
-
-  Matrices.model = glm::mat4(1.0f);
-  glm::mat4 rotateBaskCirc1 = glm::rotate((float)(-80*M_PI/180.0f), glm::vec3(1,0,0)); 
-  glm::mat4 transBaskCirc1 = glm::translate (glm::vec3(bcx+bx,bcy,0));
-  Matrices.model *= transBaskCirc1*rotateBaskCirc1;
-  MVP = VP * Matrices.model;
-  glUniformMatrix4fv(Matrices.MatrixID,1,GL_FALSE,&MVP[0][0]);
-  draw3DObject(bask_circ);
-  Matrices.model = glm::mat4(1.0f);
-  transBaskCirc1 = glm::translate (glm::vec3(bcx+bx,bcy-25,0));
-  rotateBaskCirc1 = glm::rotate((float)(80*M_PI/180.0f), glm::vec3(1,0,0)); 
-  Matrices.model *= transBaskCirc1*rotateBaskCirc1;
-  MVP = VP * Matrices.model;
-  glUniformMatrix4fv(Matrices.MatrixID,1,GL_FALSE,&MVP[0][0]);
-  draw3DObject(bask_circ);  
+  useProgram (fallingBrickProgramID,-1);
+  glUniform1f(FallingBrickTimeID,snapshot_clocks[render_slot]-fall_origins[render_slot]);
+  setPolygonMode (falling_brick_quad->FillMode);
+  bindVertexArray (falling_brick_quad->VertexArrayID);
+  glDrawElementsInstanced(falling_brick_quad->PrimitiveMode, falling_brick_quad->NumIndices, GL_UNSIGNED_SHORT, (void*)0, slots);
+  frame_stats.draw_calls++;
 
+  useProgram (programID,Matrices.TintID);
 }
 
-}bucket[2];
+/* --particles : bursts of particles where a brick is shot or caught, simulated on the GPU with transform
+   feedback. The update thread only records where bursts start; the render thread hands the new ones to the
+   update shader as uniforms, which advances all particles from one buffer of the ping-pong pair into the other */
+struct Particle {
+    GLfloat x,y;
+    GLfloat vx,vy;
+    GLfloat life;      // seconds left, dead at 0
+    GLfloat r,g,b;
+};
 
-VAO *rect1,*rect2;
+struct Burst {
+    GLfloat x,y;
+    GLfloat r,g,b;
+};
 
-void createRectangle()
+const int MAX_PARTICLES = 4096;
+const int PARTICLES_PER_BURST = 64;   // matches ParticleUpdate_GL.vert
+const int MAX_BURSTS = 8;             // bursts started per update pass, also in the shader
+const int BURST_HISTORY = 64;
+const GLfloat PARTICLE_LIFETIME = 0.8;
+
+int use_particles=0;
+GLuint particle_buffers[2],particle_vaos[2];
+int particle_source=0;   // half holding the current particles
+GLuint particleUpdateProgramID,particleProgramID;
+GLint ParticleBurstsID,ParticleBurstColorsID,ParticleBurstCountID,ParticleDtID;
+
+Burst bursts[BURST_HISTORY];                  // ring written by the update thread
+long long int bursts_started=0;
+Burst burst_histories[SNAPSHOT_SLOTS][BURST_HISTORY];
+long long int burst_totals[SNAPSHOT_SLOTS];
+long long int bursts_kept_from=0;             // bursts before this one belong to a game that has ended
+long long int burst_firsts[SNAPSHOT_SLOTS];
+long long int bursts_drawn=0;                 // render thread : bursts already handed to the GPU
+int next_particle=0;
+double particle_clock=0,particles_alive_until=-1;
+
+void addBurst(float x,float y,int color)
 {
-  static const GLfloat vertex_buffer_data [] = {
-    -2,-0.5,0,
-    -2,0.5,0,
-    2,0.5,0,
-
-    2,0.5,0,
-    2,-0.5,0,
-    -2,-0.5,0,
-  };
-
-  static const GLfloat color_buffer_data [] = {
-    0,0,0,
-    0,0,0,
-    0,0,0,
-
-    0,0,0,
-    0,0,0,
-    0,0,0,
-  };
-  rect1 = create3DObject(GL_TRIANGLES,6,vertex_buffer_data,color_buffer_data,GL_FILL);
-
+  if(!use_particles)
+    return;
+  Burst& burst=bursts[bursts_started%BURST_HISTORY];
+  burst.x=x;
+  burst.y=y;
+  burst.r=brick_palette[3*color];
+  burst.g=brick_palette[3*color+1];
+  burst.b=brick_palette[3*color+2];
+  bursts_started++;
 }
 
-void createRectangle2()
+void createParticles()
 {
-  static const GLfloat vertex_buffer_data [] = {
-    -7,-5,0,
-    -7,5,0,
-    7,5,0,
+  std::vector<Particle> dead(MAX_PARTICLES);
+  for(int i=0;i<2;i++)
+  {
+    particle_vaos[i] = genVertexArray();
+    bindVertexArray (particle_vaos[i]);
+    particle_buffers[i] = genBuffer();
+    bindArrayBuffer (particle_buffers[i]);
+    glBufferData (GL_ARRAY_BUFFER, MAX_PARTICLES*sizeof(Particle), &dead[0], GL_STREAM_COPY);
+    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(Particle), (void*)offsetof(Particle, x));
+    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(Particle), (void*)offsetof(Particle, vx));
+    glVertexAttribPointer(2, 1, GL_FLOAT, GL_FALSE, sizeof(Particle), (void*)offsetof(Particle, life));
+    glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, sizeof(Particle), (void*)offsetof(Particle, r));
+    for(int a=0;a<4;a++)
+      glEnableVertexAttribArray(a);
+  }
+  bytes_uploaded += 2*MAX_PARTICLES*sizeof(Particle);
+}
 
-    7,5,0,
-    7,-5,0,
-    -7,-5,0,
-  };
+void releaseParticles()
+{
+  for(int i=0;i<2;i++)
+  {
+    deleteVertexArray(particle_vaos[i]);
+    deleteBuffer(particle_buffers[i]);
+  }
+}
 
-  static const GLfloat color_buffer_data [] = {
-    0.5,0.5,1,
-    0.5,0.5,1,
-    0.5,0.5,1,
+/* Start the bursts the snapshot has that the GPU has not seen, advance every particle, then draw them.
+   The CPU cost is per burst; particles never leave the GPU */
+void drawParticles()
+{
+  double clock=snapshot_clocks[render_slot];
+  GLfloat dt=std::max(clock-particle_clock,0.0);
+  particle_clock=clock;
+
+  long long int total=burst_totals[render_slot];
+  if(bursts_drawn<burst_firsts[render_slot])
+    bursts_drawn=burst_firsts[render_slot];   // started as the last game ended, never shown
+  if(total-bursts_drawn>BURST_HISTORY)
+    bursts_drawn=total-BURST_HISTORY;   // older ones were overwritten before a frame picked them up
+  GLfloat starts[4*MAX_BURSTS]={0},colors[3*MAX_BURSTS]={0};
+  int count=0;
+  for(;bursts_drawn<total && count<MAX_BURSTS;bursts_drawn++,count++)
+  {
+    const Burst& burst=burst_histories[render_slot][bursts_drawn%BURST_HISTORY];
+    starts[4*count]=burst.x;
+    starts[4*count+1]=burst.y;
+    starts[4*count+2]=next_particle;
+    starts[4*count+3]=0;
+    colors[3*count]=burst.r;
+    colors[3*count+1]=burst.g;
+    colors[3*count+2]=burst.b;
+    next_particle=(next_particle+PARTICLES_PER_BURST)%MAX_PARTICLES;
+  }
+  if(count>0)
+    particles_alive_until=clock+PARTICLE_LIFETIME;
+  else if(clock>particles_alive_until)
+    return;
 
-    0.5,0.5,1,
-    0.5,0.5,1,
-    0.5,0.5,1,
-  };
-  rect2 = create3DObject(GL_TRIANGLES,6,vertex_buffer_data,color_buffer_data,GL_FILL);
+  setPolygonMode (GL_FILL);
+  if(count>0 || dt>0)
+  {
+    useProgram (particleUpdateProgramID,-1);
+    glUniform4fv(ParticleBurstsID,MAX_BURSTS,starts);
+    glUniform3fv(ParticleBurstColorsID,MAX_BURSTS,colors);
+    glUniform1i(ParticleBurstCountID,count);
+    glUniform1f(ParticleDtID,dt);
+
+    glEnable(GL_RASTERIZER_DISCARD);
+    bindVertexArray (particle_vaos[particle_source]);
+    glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, particle_buffers[1-particle_source]);
+    glBeginTransformFeedback(GL_POINTS);
+    glDrawArrays(GL_POINTS, 0, MAX_PARTICLES);
+    glEndTransformFeedback();
+    glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, 0);
+    glDisable(GL_RASTERIZER_DISCARD);
+    particle_source=1-particle_source;
+    frame_stats.draw_calls++;
+  }
 
+  useProgram (particleProgramID,-1);
+  bindVertexArray (particle_vaos[particle_source]);
+  glDrawArrays(GL_POINTS, 0, MAX_PARTICLES);
+  frame_stats.draw_calls++;
 }
 
 class Bricks {
 
 public:
-  VAO* brick;
   int val,val2,rem_flag,visit;
   float x,y;
+  float y0,rate;     // fall as y0 - rate*(game_clock - t0), with --gpu-bricks
+  double t0;
 
 public:
   Bricks()
@@ -768,62 +2071,11 @@ public:
     rem_flag=0;
     visit=0;
   }
-  ~Bricks()
-  {
-    free(brick);
-  }
 
 void createBrick()
 {
-  static const GLfloat vertex_buffer_data [] = {
-    -1.5,0,0,
-    -1.5,7,0,
-    1.5,7,0,
-
-    1.5,7,0,
-    1.5,0,0,
-    -1.5,0,0,
-  };
-
-  static const GLfloat color_buffer_data [] = {
-    1,0,0,
-    1,0,0,
-    1,0,0,
-
-    1,0,0,
-    1,0,0,
-    1,0,0,
-  };
-
-  static const GLfloat color_buffer_data1 [] = {
-    0,1,0,
-    0,1,0,
-    0,1,0,
-
-    0,1,0,
-    0,1,0,
-    0,1,0,
-  };
-
-  static const GLfloat color_buffer_data2 [] = {
-    0,0,0,
-    0,0,0,
-    0,0,0,
-
-    0,0,0,
-    0,0,0,
-    0,0,0,
-  };
-
-  if(val2==0)
-    brick= create3DObject(GL_TRIANGLES,6,vertex_buffer_data,color_buffer_data2,GL_FILL);
-  else if(val2==1)
-    brick = create3DObject(GL_TRIANGLES,6,vertex_buffer_data,color_buffer_data,GL_FILL);
-  else
-    brick = create3DObject(GL_TRIANGLES,6,vertex_buffer_data,color_buffer_data1,GL_FILL);
     rem_flag=0;
     visit=0;
-
 }
 void generateBlock()
 {
@@ -846,18 +2098,36 @@ void generateBlock()
       x=5.0+40*(rand()*1.0/RAND_MAX);
       y=95;
     }
+    y0=y;
+    t0=game_clock;
+    rate=brickFallRate();
+}
+
+/* Start falling at the current speed from where the brick is now */
+void rebase()
+{
+    y0=y0-rate*(game_clock-t0);
+    t0=game_clock;
+    rate=brickFallRate();
+}
+
+BrickSpawn spawn()
+{
+    BrickSpawn record = {x, y0, (GLfloat)(t0-fall_origin), rate, (GLfloat)val2};
+    return record;
 }
 
 void checkBlock()
 {
   int flag=0,flag2=0;
-  if(fall_flag==1)
+  if(gpu_bricks)
+    y=y0-rate*(game_clock-t0);
+  else if(fall_flag==1)
     y-=1.5+0.2*speed_var;
   if(rem_flag==1)
   {
     if(y<=-90)
     {
-      free(brick);
       f++;
     }
     return;
@@ -942,23 +2212,127 @@ void checkBlock()
 
     }
 
+    // Caught by a bucket
+    if(flag==1)
+      addBurst(x,y,val2);
   } 
-  Matrices.model = glm::mat4(1.0f);
-  glm::mat4 transMirror = glm::translate (glm::vec3(x,y,0));
-  Matrices.model *=transMirror;
-  MVP= VP * Matrices.model;
-  glUniformMatrix4fv(Matrices.MatrixID,1,GL_FALSE,&MVP[0][0]);
-  draw3DObject(brick);
   if(y<=-88)
   {
-    free(brick);
     f++;
   }
 }
 
+void extract()
+{
+  if(rem_flag==0)
+    addBrickInstance(x,y,val2);
+}
+
 
 }block[1000];
 
+/* Spawn table upkeep : record i follows block[i] and is written where the brick changes */
+void writeBrickSpawn(int i,const BrickSpawn& record)
+{
+  if(!gpu_bricks)
+    return;
+  brick_spawns[i]=record;
+  widenRange(brick_spawns_lo,brick_spawns_hi,i);
+  for(int slot=0;slot<SNAPSHOT_SLOTS;slot++)
+    widenRange(brick_missing_lo[slot],brick_missing_hi[slot],i);
+}
+
+void clearBrickSpawn(int i)
+{
+  BrickSpawn empty = {0, 0, 0, 0, -1};
+  writeBrickSpawn(i,empty);
+}
+
+void writeBrickSpawn(int i)
+{
+  if(block[i].rem_flag==0)
+    writeBrickSpawn(i,block[i].spawn());
+  else
+    clearBrickSpawn(i);
+}
+
+/* Bring the slot's copy of the table up to date, giving it a new version if records were written this tick */
+void copyBrickSpawns()
+{
+  if(brick_spawns_hi>brick_spawns_lo)
+  {
+    brick_spawns_version++;
+    brick_version_lo=brick_spawns_lo;
+    brick_version_hi=brick_spawns_hi;
+    brick_spawns_lo=brick_spawns_hi=0;
+  }
+
+  int& lo=brick_missing_lo[update_slot];
+  int& hi=brick_missing_hi[update_slot];
+  if(hi>lo)
+    memcpy(brick_tables[update_slot]+lo,brick_spawns+lo,(hi-lo)*sizeof(BrickSpawn));
+  lo=hi=0;
+  brick_table_versions[update_slot]=brick_spawns_version;
+  brick_table_lo[update_slot]=brick_version_lo;
+  brick_table_hi[update_slot]=brick_version_hi;
+  brick_table_slots[update_slot]=std::min(poi,1000LL);
+}
+
+
+/* Bullets are drawn instanced from one disc quad : one (centre, radius) record per live bullet */
+struct BulletInstance {
+    GLfloat x,y;
+    GLfloat radius;
+};
+
+VAO *bullet_quad;
+GLuint bulletProgramID;
+BulletInstance bullet_instances[SNAPSHOT_SLOTS][1000];
+int num_bullet_instances[SNAPSHOT_SLOTS];
+
+void createBulletQuad()
+{
+  bullet_quad = createQuadObject(-1,-1,1,1,0,1,1,GL_FILL);
+
+  // Per-instance attributes are streamed each frame, advanced once per bullet
+  bindVertexArray (bullet_quad->VertexArrayID);
+  pointInstanceAttributes(stream_buffer, sizeof(BulletInstance), 0);
+  glVertexAttribDivisor(2, 1);
+  glVertexAttribDivisor(3, 1);
+  glEnableVertexAttribArray(2);
+  glEnableVertexAttribArray(3);
+}
+
+void addBulletInstance(float x,float y,float radius)
+{
+  int& count=num_bullet_instances[update_slot];
+  if(count>=1000 || !inView(x-radius,y-radius,x+radius,y+radius))
+    return;
+  bullet_instances[update_slot][count].x=x;
+  bullet_instances[update_slot][count].y=y;
+  bullet_instances[update_slot][count].radius=radius;
+  count++;
+}
+
+/* Draw every bullet collected this step with a single instanced call */
+void drawBullets()
+{
+  int count=num_bullet_instances[render_slot];
+  if(count>0)
+  {
+    useProgram (bulletProgramID,-1);
+
+    GLintptr offset = streamData(bullet_instances[render_slot], count*sizeof(BulletInstance));
+
+    setPolygonMode (bullet_quad->FillMode);
+    bindVertexArray (bullet_quad->VertexArrayID);
+    pointInstanceAttributes(stream_buffer, sizeof(BulletInstance), offset);
+    glDrawElementsInstanced(bullet_quad->PrimitiveMode, bullet_quad->NumIndices, GL_UNSIGNED_SHORT, (void*)0, count);
+    frame_stats.draw_calls++;
+
+    useProgram (programID,Matrices.TintID);
+  }
+}
 
 class Bullets{
 public:
@@ -979,50 +2353,12 @@ public:
     radius=2.5;
 //    rotation_angle=Laser.laser_rot;
   }
-  ~Bullets()
-  {
-    free(bullet);
-  }
 
   void createBullet(){
     x=Laser.l2x;
     y=Laser.l2y+Laser.lasery;
     rotation_angle=Laser.laser_rot;
-    static GLfloat vertex_buffer_data [360*9];
-    static GLfloat color_buffer_data [360*9];
-    for(int i=0;i<360;i++)
-    {
-      vertex_buffer_data[9*i]=0;
-      vertex_buffer_data[9*i+1]=0;
-      vertex_buffer_data[9*i+2]=0;
-
-      vertex_buffer_data[9*i+3]=radius*cos(i*M_PI/180);
-      vertex_buffer_data[9*i+4]=radius*sin(i*M_PI/180);
-      vertex_buffer_data[9*i+5]=0;
-
-      vertex_buffer_data[9*i+6]=radius*cos(((i+1)%360)*M_PI/180);
-      vertex_buffer_data[9*i+7]=radius*sin(((i+1)%360)*M_PI/180);
-      vertex_buffer_data[9*i+8]=0;
-
-    }
-
-    for(int i=0;i<360;i++)
-    {
-      color_buffer_data[9*i]=0;
-      color_buffer_data[9*i+1]=1;
-      color_buffer_data[9*i+2]=1;
-
-      color_buffer_data[9*i+3]=0;
-      color_buffer_data[9*i+4]=1;
-      color_buffer_data[9*i+5]=1;
-
-      color_buffer_data[9*i+6]=0;
-      color_buffer_data[9*i+7]=1;
-      color_buffer_data[9*i+8]=1;
-
-    }
-
-    bullet=create3DObject(GL_TRIANGLES,360*3,vertex_buffer_data,color_buffer_data,GL_FILL);
+    bullet=getCircleMesh(bullet_circle);
     axis_x=15;
     axis_y=0;
     pre_flag=-1;
@@ -1082,7 +2418,7 @@ public:
   }
 
 
-  void draw()
+  void step()
   {
     if(rem_flag==1)
     {
@@ -1103,6 +2439,8 @@ public:
       {
 
         block[i%1000].rem_flag=1;
+        writeBrickSpawn(i%1000);
+        addBurst(block[i%1000].x,block[i%1000].y+3.5,block[i%1000].val2);
         if(block[i%1000].val2==0)
         {
           system("mpg123 -vC score.mp3 &");
@@ -1155,14 +2493,6 @@ public:
       }
     }
 //    printf("%lf\n",rotation_angle);
-    Matrices.model = glm::mat4(1.0f);
-    glm::mat4 transBullet1 = glm::translate (glm::vec3(axis_x,axis_y,0));
-    glm::mat4 transBullet2 = glm::translate (glm::vec3(x,y,0));
-    glm::mat4 rotateBullet = glm::rotate((float)(rotation_angle*M_PI/180.0f), glm::vec3(0,0,1));
-    Matrices.model *=transBullet2 * rotateBullet * transBullet1;
-    MVP= VP * Matrices.model;
-    glUniformMatrix4fv(Matrices.MatrixID,1,GL_FALSE,&MVP[0][0]);
-    draw3DObject(bullet);
     axis_x+=2;
     if(x+axis_x*cos(rotation_angle*M_PI/180)<-100 || x+axis_x*cos(rotation_angle*M_PI/180)>71 || y+axis_x*sin(rotation_angle*M_PI/180)<-65 || y+axis_x*sin(rotation_angle*M_PI/180)>100 )
     {
@@ -1171,12 +2501,27 @@ public:
     }
   }
 
+  void extract()
+  {
+    if(rem_flag==1)
+      return;
+    if(sdf_discs)
+      addBulletInstance(x+axis_x*cos(rotation_angle*M_PI/180),y+axis_x*sin(rotation_angle*M_PI/180),radius);
+    else
+    {
+    // The bullet sits axis_x along its direction of travel from (x,y)
+    float angle=rotation_angle*M_PI/180;
+    float bullet_x=x+axis_x*cos(angle)-axis_y*sin(angle),bullet_y=y+axis_x*sin(angle)+axis_y*cos(angle);
+    if(inView(bullet_x-radius,bullet_y-radius,bullet_x+radius,bullet_y+radius))
+      submit3DObject(LAYER_BULLETS,bullet,place(bullet_x,bullet_y,rotation_angle),0,1,1);
+    }
+  }
+
 };
 
 Bullets blt[1000];
-/* Executed when a regular key is pressed/released/held-down */
-/* Prefered for Keyboard events */
-void keyboard (GLFWwindow* window, int key, int scancode, int action, int mods)
+/* Applied on the update thread for each key event keyboard() queued */
+void applyKey (int key, int action)
 {
      // Function is called first on GLFW_PRESS.
 
@@ -1355,9 +2700,6 @@ void keyboard (GLFWwindow* window, int key, int scancode, int action, int mods)
                 break;
             case GLFW_KEY_DOWN:
                 break;
-            case GLFW_KEY_ESCAPE:
-                quit(window);
-                break;
             default:
                 break;
         }
@@ -1365,6 +2707,23 @@ void keyboard (GLFWwindow* window, int key, int scancode, int action, int mods)
     }
 }
 
+/* Hand an input event to the update thread */
+void queueInput (int type, int code, int action, double x, double y)
+{
+  InputEvent event = {type, code, action, x, y};
+  std::lock_guard<std::mutex> lock(input_mutex);
+  input_events.push_back(event);
+}
+
+/* Executed when a regular key is pressed/released/held-down */
+/* Prefered for Keyboard events */
+void keyboard (GLFWwindow* window, int key, int scancode, int action, int mods)
+{
+    if (key == GLFW_KEY_ESCAPE && action == GLFW_PRESS)
+        quit(window);
+    queueInput(INPUT_KEY, key, action, 0, 0);
+}
+
 /* Executed for character input (like in text boxes) */
 void keyboardChar (GLFWwindow* window, unsigned int key)
 {
@@ -1380,8 +2739,8 @@ void keyboardChar (GLFWwindow* window, unsigned int key)
 
 double x_g,y_g,val;
 
-/* Executed when a mouse button is pressed/released */
-void mouseButton (GLFWwindow* window, int button, int action, int mods)
+/* Applied on the update thread for each mouse button event, with the cursor where it was when clicked */
+void applyMouseButton (int button, int action, double xpos, double ypos)
 {
     switch (button) {
         case GLFW_MOUSE_BUTTON_LEFT:
@@ -1397,7 +2756,6 @@ void mouseButton (GLFWwindow* window, int button, int action, int mods)
             }
             else if(action == GLFW_PRESS)
             {
-                glfwGetCursorPos(window, &xpos, &ypos);
                 x_g=(xpos-400)*1.0/4;
                 y_g=(300-ypos)*1.0/3;
                 Laser.checkClick((xpos-400)*1.0/4,(300-ypos)*1.0/3);
@@ -1485,7 +2843,6 @@ void mouseButton (GLFWwindow* window, int button, int action, int mods)
             }
             else if(action==GLFW_PRESS)
             {
-              glfwGetCursorPos(window, &xpos, &ypos);
               x_g=(xpos-400)*1.0/4;
               y_g=(300-ypos)*1.0/3;
               mouse_pan=1;
@@ -1497,7 +2854,15 @@ void mouseButton (GLFWwindow* window, int button, int action, int mods)
     }
 }
 
-void scroll_callback(GLFWwindow* window, double xoffset, double yoffset)
+/* Executed when a mouse button is pressed/released */
+void mouseButton (GLFWwindow* window, int button, int action, int mods)
+{
+    double x,y;
+    glfwGetCursorPos(window, &x, &y);
+    queueInput(INPUT_MOUSE_BUTTON, button, action, x, y);
+}
+
+void applyScroll (double xoffset, double yoffset)
 {
   if(yoffset>0 && zoom<50)
     zoom+=yoffset*2;
@@ -1523,6 +2888,35 @@ void scroll_callback(GLFWwindow* window, double xoffset, double yoffset)
   }
 }
 
+void scroll_callback(GLFWwindow* window, double xoffset, double yoffset)
+{
+  queueInput(INPUT_SCROLL, 0, 0, xoffset, yoffset);
+}
+
+/* Apply the input queued since the last tick, in the order it arrived */
+void applyInputEvents ()
+{
+  static std::vector<InputEvent> events;
+  {
+    std::lock_guard<std::mutex> lock(input_mutex);
+    events.swap(input_events);
+  }
+  for(size_t i=0;i<events.size();i++)
+  {
+    const InputEvent& event=events[i];
+    if(event.type==INPUT_KEY)
+      applyKey(event.code,event.action);
+    else if(event.type==INPUT_MOUSE_BUTTON)
+      applyMouseButton(event.code,event.action,event.x,event.y);
+    else
+      applyScroll(event.x,event.y);
+  }
+  events.clear();
+}
+
+/* Framebuffer size, and a count of resizes that cached layers compare against to know they are stale */
+int framebuffer_width=0,framebuffer_height=0,reshape_count=0;
+
 /* Executed when window is resized to 'width' and 'height' */
 /* Modify the bounds of the screen here in glm::ortho or Field of View in glm::Perspective */
 void reshapeWindow (GLFWwindow* window, int width, int height)
@@ -1536,6 +2930,9 @@ void reshapeWindow (GLFWwindow* window, int width, int height)
 
     // sets the viewport of openGL renderer
     glViewport (0, 0, (GLsizei) fbwidth, (GLsizei) fbheight);
+    framebuffer_width = fbwidth;
+    framebuffer_height = fbheight;
+    reshape_count++;
 
     // set the projection matrix as perspective
     /* glMatrixMode (GL_PROJECTION);
@@ -1545,10 +2942,224 @@ void reshapeWindow (GLFWwindow* window, int width, int height)
     // Perspective projection for 3D views
     // Matrices.projection = glm::perspective (fov, (GLfloat) fbwidth / (GLfloat) fbheight, 0.1f, 500.0f);
 
-    // Ortho projection for 2D views
-    Matrices.projection = glm::ortho(-100.0f+zoom*2, 100.0f-zoom*2, -100.0f+zoom*2, 100.0f-zoom*2, 0.1f, 500.0f);
+    // Ortho projection for 2D views : update() builds it from zoom and pan every tick
+}
+
+
+/* Seven-segment numbers : one instanced quad per digit, the fragment shader lights the segments.
+   Digits are only rebuilt and uploaded when a number on screen changes */
+struct DigitInstance {
+    GLfloat x,y;
+    GLfloat digit;   // 0-9, 10 for a minus sign
+};
+
+struct HUDNumber {
+    float x,y;
+    int value;
+};
+
+const int MAX_HUD_NUMBERS = 8;
+VAO *digit_quad;
+GLuint DigitInstanceBuffer;
+GLuint digitProgramID;
+DigitInstance digit_instances[MAX_HUD_NUMBERS*12];
+int num_digit_instances=0;
+HUDNumber hud_numbers[SNAPSHOT_SLOTS][MAX_HUD_NUMBERS],shown_numbers[MAX_HUD_NUMBERS];
+int num_hud_numbers[SNAPSHOT_SLOTS],num_shown_numbers=-1;
+
+void createDigitQuad()
+{
+  // A cell around the bars draw_rect used, relative to the bottom bar's centre
+  digit_quad = createQuadObject(-2.5,-0.5,2.5,8.5,0,0,0,GL_FILL);
+
+  bindVertexArray (digit_quad->VertexArrayID);
+  DigitInstanceBuffer = genBuffer();
+  bindArrayBuffer (DigitInstanceBuffer);
+  glBufferData (GL_ARRAY_BUFFER, sizeof(digit_instances), NULL, GL_DYNAMIC_DRAW);
+  pointInstanceAttributes(DigitInstanceBuffer, sizeof(DigitInstance), 0);
+  glVertexAttribDivisor(2, 1);
+  glVertexAttribDivisor(3, 1);
+  glEnableVertexAttribArray(2);
+  glEnableVertexAttribArray(3);
+}
+
+/* Show value with its last digit at (x,y), digits running leftwards 6 apart */
+void addNumber(float x,float y,int value)
+{
+  int cells=(value<0)+1;
+  for(int rest=std::abs(value)/10;rest>0;rest/=10)
+    cells++;
+  int& count=num_hud_numbers[update_slot];
+  if(count>=MAX_HUD_NUMBERS || !inView(x-6*(cells-1)-2.5,y-0.5,x+2.5,y+8.5))
+    return;
+  hud_numbers[update_slot][count].x=x;
+  hud_numbers[update_slot][count].y=y;
+  hud_numbers[update_slot][count].value=value;
+  count++;
+}
+
+void addDigit(float x,float y,int digit)
+{
+  digit_instances[num_digit_instances].x=x;
+  digit_instances[num_digit_instances].y=y;
+  digit_instances[num_digit_instances].digit=digit;
+  num_digit_instances++;
+}
+
+/* Draw every number added this frame with one instanced call */
+void drawDigits()
+{
+  const HUDNumber *numbers=hud_numbers[render_slot];
+  int count=num_hud_numbers[render_slot];
+  if(count!=num_shown_numbers || memcmp(numbers,shown_numbers,count*sizeof(HUDNumber)))
+  {
+    num_digit_instances=0;
+    for(int n=0;n<count;n++)
+    {
+      int value=numbers[n].value,i=0;
+      bool negative=value<0;
+      if(negative)
+        value=-value;
+      do
+      {
+        addDigit(numbers[n].x-6*i,numbers[n].y,value%10);
+        value/=10;
+        i++;
+      }while(value>0);
+      if(negative)
+        addDigit(numbers[n].x-6*i,numbers[n].y,10);
+    }
+    memcpy(shown_numbers,numbers,count*sizeof(HUDNumber));
+    num_shown_numbers=count;
+
+    bindArrayBuffer (DigitInstanceBuffer);
+    glBufferSubData (GL_ARRAY_BUFFER, 0, num_digit_instances*sizeof(DigitInstance), digit_instances);
+    bytes_uploaded += num_digit_instances*sizeof(DigitInstance);
+  }
+
+  if(num_digit_instances>0)
+  {
+    useProgram (digitProgramID,-1);
+    setPolygonMode (digit_quad->FillMode);
+    bindVertexArray (digit_quad->VertexArrayID);
+    glDrawElementsInstanced(digit_quad->PrimitiveMode, digit_quad->NumIndices, GL_UNSIGNED_SHORT, (void*)0, num_digit_instances);
+    frame_stats.draw_calls++;
+  }
+}
+
+/* HUD text : strings are drawn from the baked glyph atlas, one draw each.
+   A label's quads are laid out once, the first time it is shown, and kept in its own VAO */
+struct TextVertex {
+    GLfloat x,y;
+    GLfloat u,v;
+};
+
+struct TextLabel {
+    const char *text;
+    float x,y;       // origin of the last letter; letters run leftwards 5 apart
+    GLuint vao,buffer;
+    int quads;
+};
+
+TextLabel score_label = {"SCORE",95,85,0,0,0};
+TextLabel lives_label = {"LIVES",95,60,0,0,0};
+TextLabel level_label = {"LEVEL",95,40,0,0,0};
+TextLabel final_score_label = {"SCORE",0,0,0,0,0};
+TextLabel gameover_label = {"GAME OVER",22.5,20,0,0,0};
+TextLabel *all_labels[] = {&score_label,&lives_label,&level_label,&final_score_label,&gameover_label};
+
+constexpr glyphs::Atlas glyph_atlas;
+GLuint glyph_texture;
+GLuint textProgramID;
+TextLabel *shown_labels[SNAPSHOT_SLOTS][8];
+int num_shown_labels[SNAPSHOT_SLOTS];
+
+void createGlyphTexture()
+{
+  glyph_texture = genTexture();
+  glBindTexture(GL_TEXTURE_2D, glyph_texture);
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, glyphs::ATLAS_WIDTH, glyphs::ATLAS_HEIGHT, 0, GL_RED, GL_UNSIGNED_BYTE, glyph_atlas.pixels);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  bytes_uploaded += sizeof(glyph_atlas.pixels);
+}
+
+/* Build the label's quads : one per letter, spaces only advance */
+void layoutLabel(TextLabel& label)
+{
+  std::vector<TextVertex> vertices;
+  int length=strlen(label.text);
+  for(int i=0;i<length;i++)
+  {
+    int g=glyphs::find(label.text[i]);
+    if(g<0)
+      continue;
+    float ox=label.x-5*(length-1-i),oy=label.y;
+    float x0=ox+glyphs::CELL_LEFT,y0=oy+glyphs::CELL_BOTTOM;
+    float x1=x0+glyphs::CELL_UNITS_X,y1=y0+glyphs::CELL_UNITS_Y;
+    float u0=(float)g/glyphs::GLYPHS,u1=(float)(g+1)/glyphs::GLYPHS;
+    // Same corner order as geometry::IndexedQuad, so the HUD batch indices fit
+    TextVertex corners[4] = {{x0,y0,u0,0}, {x0,y1,u0,1}, {x1,y1,u1,1}, {x1,y0,u1,0}};
+    vertices.insert(vertices.end(), corners, corners+4);
+  }
+  label.quads=vertices.size()/4;
+
+  label.vao = genVertexArray();
+  bindVertexArray (label.vao);
+  label.buffer = genBuffer();
+  bindArrayBuffer (label.buffer);
+  glBufferData (GL_ARRAY_BUFFER, vertices.size()*sizeof(TextVertex), &vertices[0], GL_STATIC_DRAW);
+  glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(TextVertex), (void*)0);
+  glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(TextVertex), (void*)(2*sizeof(GLfloat)));
+  glEnableVertexAttribArray(0);
+  glEnableVertexAttribArray(1);
+  glBindBuffer (GL_ELEMENT_ARRAY_BUFFER, batch_index_buffer);
+  bytes_uploaded += vertices.size()*sizeof(TextVertex);
+}
+
+void releaseLabels()
+{
+  for(size_t i=0;i<sizeof(all_labels)/sizeof(all_labels[0]);i++)
+  {
+    deleteVertexArray(all_labels[i]->vao);
+    deleteBuffer(all_labels[i]->buffer);
+  }
+  deleteTexture(glyph_texture);
+}
+
+void showLabel(TextLabel& label)
+{
+  float left=label.x-5*(strlen(label.text)-1)+glyphs::CELL_LEFT,bottom=label.y+glyphs::CELL_BOTTOM;
+  if(!inView(left,bottom,label.x-glyphs::CELL_LEFT,bottom+glyphs::CELL_UNITS_Y))
+    return;
+  int& count=num_shown_labels[update_slot];
+  if(count<8)
+    shown_labels[update_slot][count++]=&label;
 }
 
+/* Draw the labels shown this frame */
+void drawLabels()
+{
+  int count=num_shown_labels[render_slot];
+  if(count>0)
+  {
+    useProgram (textProgramID,-1);
+    setPolygonMode (GL_FILL);
+    glBindTexture(GL_TEXTURE_2D, glyph_texture);
+    for(int i=0;i<count;i++)
+    {
+      TextLabel& label=*shown_labels[render_slot][i];
+      if(label.vao==0)
+        layoutLabel(label);
+      bindVertexArray (label.vao);
+      glDrawElements(GL_TRIANGLES, label.quads*6, GL_UNSIGNED_SHORT, (void*)0);
+      frame_stats.draw_calls++;
+    }
+  }
+}
 
 float camera_rotation_angle = 90;
 
@@ -1556,32 +3167,18 @@ float camera_rotation_angle = 90;
 /* Edit this function according to your assignment */
 void draw_rect(float x,float y,float rotation)
 {
-    Matrices.model = glm::mat4(1.0f);
-    glm::mat4 rotateRect = glm::rotate((float)(rotation*M_PI/180.0f), glm::vec3(0,0,1)); 
-    glm::mat4 transRect = glm::translate (glm::vec3(x,y,0));
-    Matrices.model *= transRect*rotateRect;
-    MVP = VP * Matrices.model;
-    glUniformMatrix4fv(Matrices.MatrixID,1,GL_FALSE,&MVP[0][0]);
-    draw3DObject(rect1);
-
+    batchQuad(segment_quad,x,y,rotation,0,0,0);
 }
 
 void draw_boxes(int flag)
 {
-  glm::mat4 rotateRect,transRect;
   float x,y;
   if(flag==0)
   {
     x=-91;
     y=93;
 
-    Matrices.model = glm::mat4(1.0f);
-    rotateRect = glm::rotate((float)(0*M_PI/180.0f), glm::vec3(0,0,1)); 
-    transRect = glm::translate (glm::vec3(x,y,0));
-    Matrices.model *= transRect*rotateRect;
-    MVP = VP * Matrices.model;
-    glUniformMatrix4fv(Matrices.MatrixID,1,GL_FALSE,&MVP[0][0]);
-    draw3DObject(rect2);
+    batchQuad(box_quad,x,y,0,0.5,0.5,1);
 
     draw_rect(x-2,y,90);
     draw_rect(x+2,y,90);
@@ -1592,13 +3189,7 @@ void draw_boxes(int flag)
     x=-91;
     y=81;
 
-    Matrices.model = glm::mat4(1.0f);
-    rotateRect = glm::rotate((float)(0*M_PI/180.0f), glm::vec3(0,0,1)); 
-    transRect = glm::translate (glm::vec3(x,y,0));
-    Matrices.model *= transRect*rotateRect;
-    MVP = VP * Matrices.model;
-    glUniformMatrix4fv(Matrices.MatrixID,1,GL_FALSE,&MVP[0][0]);
-    draw3DObject(rect2);
+    batchQuad(box_quad,x,y,0,0.5,0.5,1);
     draw_rect(x-2,y,90);
     draw_rect(x-2+2*cos(30.0*M_PI/180),y+1,-30);
     draw_rect(x-2+2*cos(30.0*M_PI/180),y-2*cos(60.0*M_PI/180),30);
@@ -1609,13 +3200,7 @@ void draw_boxes(int flag)
     x=1;
     y=-13;
 
-    Matrices.model = glm::mat4(1.0f);
-    rotateRect = glm::rotate((float)(0*M_PI/180.0f), glm::vec3(0,0,1)); 
-    transRect = glm::translate (glm::vec3(x,y,0));
-    Matrices.model *= transRect*rotateRect;
-    MVP = VP * Matrices.model;
-    glUniformMatrix4fv(Matrices.MatrixID,1,GL_FALSE,&MVP[0][0]);
-    draw3DObject(rect2);
+    batchQuad(box_quad,x,y,0,0.5,0.5,1);
     draw_rect(x-2,y,90);
     draw_rect(x-2+2*cos(30.0*M_PI/180),y+1,-30);
     draw_rect(x-2+2*cos(30.0*M_PI/180),y-2*cos(60.0*M_PI/180),30);
@@ -1625,18 +3210,12 @@ void draw_boxes(int flag)
 
 void draw_score(int flag)
 {
-  int value,value2,shift=6,flag2=0,i;
-  i=0;
+  int value;
   float x=95,y;
   if(flag==0||flag==2)
   {
   value=score;
   y=70;
-  if(value<0)
-  {
-    flag2=1;
-    value=-1*value;
-  }
   }
   else if(flag==1)
   {
@@ -1654,259 +3233,153 @@ void draw_score(int flag)
     x=25;
     y=0;
   }
-  do
-  {
-    value2=value%10;
-    value=value/10;
-    if(value2==2||value2==3||value2==5||value2==6||value2==8||value2==9||value2==0)
-    {
-      draw_rect(x-shift*i,y,0);
-    }
-    if(value2==2||value2==6||value2==8||value2==0)
-    {
-      draw_rect(x-2-shift*i,y+2,90);
-    }
-    if(value2==4||value2==5||value2==6||value2==8||value2==9||value2==0)
-    {
-      draw_rect(x-2-shift*i,y+6,90);
-    }
-    if(value2==2||value2==3||value2==5||value2==6||value2==8||value2==9||value2==7||value2==0)
-    {
-      draw_rect(x-shift*i,y+8,0);
-    }
-    if(value2==1||value2==2||value2==3||value2==4||value2==7||value2==8||value2==9||value2==0)
-    {
-      draw_rect(x+2-shift*i,y+6,90);
-    }
-    if(value2==1||value2==3||value2==4||value2==5||value2==6||value2==7||value2==8||value2==9||value2==0)
-    {
-      draw_rect(x+2-shift*i,y+2,90);
-    }
-    if(value2==2||value2==3||value2==4||value2==5||value2==6||value2==8||value2==9)
-    {
-      draw_rect(x-shift*i,y+4,0);
-    }
-  i++;
-
-  }while(value>0);
-
-  if(flag2==1)
-  {
-      value=-1*value;
-      draw_rect(x-shift*i,y+4,0);
-
-  }
+  addNumber(x,y,value);
 }
 
-void draw_gameover()
-{
-  float x,y;
-  x=22.5;
-  y=20;
-
-  draw_rect(x-2,y+2,90);
-  draw_rect(x-2,y+6,90);
-  draw_rect(x,y+4,0);
-  draw_rect(x,y+8,0);
-  draw_rect(x+2,y+6,90);
-  draw_rect(x-0,y+2,-45);
-
-  draw_rect(x-5,y,0);
-  draw_rect(x-5,y+4,0);
-  draw_rect(x-5,y+8,0);
-  draw_rect(x-5-2,y+2,90);
-  draw_rect(x-5-2,y+6,90);
-
-  draw_rect(x-5*2-1+2*sin(20.0*M_PI/180),y+2*cos(20.0*M_PI/180),70);
-  draw_rect(x-5*2-1+6*sin(20.0*M_PI/180),y+6*cos(20.0*M_PI/180),70);
-  draw_rect(x-5*2-1-2*sin(20.0*M_PI/180),y+2*cos(20.0*M_PI/180),-70);
-  draw_rect(x-5*2-1-6*sin(20.0*M_PI/180),y+6*cos(20.0*M_PI/180),-70);
-
-  draw_rect(x-5*3-1,y,0);
-  draw_rect(x-5*3-2-1,y+2,90);
-  draw_rect(x-5*3-2-1,y+6,90);
-  draw_rect(x-5*3-1,y+8,0);
-  draw_rect(x-5*3+2-1,y+2,90);
-  draw_rect(x-5*3+2-1,y+6,90); 
-
-  draw_rect(x-5*5,y,0);
-  draw_rect(x-5*5,y+4,0);
-  draw_rect(x-5*5,y+8,0);
-  draw_rect(x-5*5-2,y+2,90);
-  draw_rect(x-5*5-2,y+6,90);
-
-  draw_rect(x-5*6-2+1,y+2,90);
-  draw_rect(x-5*6-2+1,y+6,90);
-  draw_rect(x-5*6+2,y+2,90);
-  draw_rect(x-5*6+2,y+6,90);
-  draw_rect(x-5*6-1-6*sin(20.0*M_PI/180)+3,y+6*cos(20.0*M_PI/180),-70);
-  draw_rect(x-5*6-1+6*sin(20.0*M_PI/180),y+6*cos(20.0*M_PI/180),70);
-
-  draw_rect(x-5*7-2*sin(20.0*M_PI/180),y+6*cos(20.0*M_PI/180),70);
-  draw_rect(x-5*7-6*sin(20.0*M_PI/180),y+2*cos(20.0*M_PI/180),70);
-  draw_rect(x-5*7+2*sin(20.0*M_PI/180),y+6*cos(20.0*M_PI/180),-70);
-  draw_rect(x-5*7+6*sin(20.0*M_PI/180),y+2*cos(20.0*M_PI/180),-70);
-  draw_rect(x-5*7,y+2,0);
-
-  draw_rect(x-5*8-1,y,0);
-  draw_rect(x-5*8,y+3,0);
-  draw_rect(x-5*8-1,y+8,0);
-  draw_rect(x-5*8-2-1,y+2,90);
-  draw_rect(x-5*8-2-1,y+6,90);
-  draw_rect(x-5*8+2-1,y+1,90);
-
-
-
-}
 
 VAO *boarder;
 void createLine()
 {
-  static const GLfloat vertex_buffer_data [] = {
-    -100,-0.5,0, // vertex 1
-    -100,0.5,0, // vertex 2
-    100, 0.5,0, // vertex 3
+  // createQuadObject creates and returns a handle to a VAO that can be used later
+  boarder = createQuadObject(-100,-0.5,100,0.5,0, 0, 0, GL_FILL);
 
-    100, 0.5,0, // vertex 3
-    100, -0.5,0, // vertex 4
-    -100,-0.5,0  // vertex 1
-  };
+}
 
-  static const GLfloat color_buffer_data [] = {
-    0,0,0, // color 1
-    0,0,0, // color 2
-    0,0,0, // color 3
+/* Layer cache - parts of the scene that only change with the camera (the borders, the HUD boxes and labels)
+   are drawn into a texture once and then composited with one screen quad per frame. A layer is drawn again
+   when the window is resized, the camera moves, or, with --no-layer-cache, every frame as before */
+struct LayerCache {
+    void (*fill)();     // draws the layer's content with the current camera
+    GLuint framebuffer=0,color=0,depth=0;
+    int width=0,height=0;   // size of the textures, 0 until first drawn
+    int reshapes=0;         // reshape_count when last drawn
+    glm::mat4 VP=glm::mat4(1.0f);   // camera it was drawn with
+    bool valid=false;
+};
 
-    0,0,0, // color 3
-    0,0,0, // color 4
-    0,0,0  // color 1
-  };
-  // create3DObject creates and returns a handle to a VAO that can be used later
-  boarder = create3DObject(GL_TRIANGLES, 6, vertex_buffer_data, color_buffer_data, GL_FILL);
+int use_layer_cache=1;
+GLuint layerProgramID;
 
+void drawBorders()
+{
+  useProgram (programID,Matrices.TintID);
+  glUniform1f(Matrices.TiltID,0);
+  glUniform4f(Matrices.TransformID,0,-65.5,0,1);
+  draw3DObject(boarder,boarder->Color[0],boarder->Color[1],boarder->Color[2]);
+  glUniform4f(Matrices.TransformID,71,0,90,1);
+  draw3DObject(boarder,boarder->Color[0],boarder->Color[1],boarder->Color[2]);
 }
 
-void draw_level()
+/* Boxes, icons and labels of the HUD, everything in it but the numbers */
+void drawStaticHUD()
 {
-  float x,y;
-  x=95;
-  y=40;
-
-  draw_rect(x+1,y,0);
-  draw_rect(x-2+1,y+2,90);
-  draw_rect(x-2+1,y+6,90);
-
-  draw_rect(x-5+1,y,0);
-  draw_rect(x-5+1,y+4,0);
-  draw_rect(x-5+1,y+8,0);
-  draw_rect(x-5-2+1,y+2,90);
-  draw_rect(x-5-2+1,y+6,90);
-
-  draw_rect(x-5*2+2*sin(20.0*M_PI/180),y+2*cos(20.0*M_PI/180),70);
-  draw_rect(x-5*2+6*sin(20.0*M_PI/180),y+6*cos(20.0*M_PI/180),70);
-  draw_rect(x-5*2-2*sin(20.0*M_PI/180),y+2*cos(20.0*M_PI/180),-70);
-  draw_rect(x-5*2-6*sin(20.0*M_PI/180),y+6*cos(20.0*M_PI/180),-70);
-
-  draw_rect(x-5*3,y,0);
-  draw_rect(x-5*3,y+4,0);
-  draw_rect(x-5*3,y+8,0);
-  draw_rect(x-5*3-2,y+2,90);
-  draw_rect(x-5*3-2,y+6,90);
+  flushBatch();
+  drawLabels();
+}
 
-  draw_rect(x-5*4,y,0);
-  draw_rect(x-5*4-2,y+2,90);
-  draw_rect(x-5*4-2,y+6,90);
+// The game-over screen has its own HUD layer, so switching between them does not redraw either
+LayerCache border_layer = {drawBorders};
+LayerCache hud_layer = {drawStaticHUD};
+LayerCache gameover_hud_layer = {drawStaticHUD};
+LayerCache *all_layers[] = {&border_layer,&hud_layer,&gameover_hud_layer};
 
-}
-void draw_scoretext(int flag_option)
+/* Colour and depth textures the size of the framebuffer. Depth doubles as coverage : texels the layer
+   never drew keep the cleared 1.0 and are discarded when composited */
+void allocateLayer(LayerCache& layer)
 {
-  float x,y;
-  if(flag_option==0)
+  if(layer.framebuffer==0)
   {
-    x=95;
-    y=85;
+    layer.framebuffer = genFramebuffer();
+    layer.color = genTexture();
+    layer.depth = genTexture();
   }
-  else if(flag_option==1)
+  layer.width=framebuffer_width;
+  layer.height=framebuffer_height;
+
+  glBindTexture(GL_TEXTURE_2D, layer.color);
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB8, layer.width, layer.height, 0, GL_RGB, GL_UNSIGNED_BYTE, NULL);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  glBindTexture(GL_TEXTURE_2D, layer.depth);
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, layer.width, layer.height, 0, GL_DEPTH_COMPONENT, GL_UNSIGNED_INT, NULL);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+  glBindFramebuffer(GL_FRAMEBUFFER, layer.framebuffer);
+  glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, layer.color, 0);
+  glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, layer.depth, 0);
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+void releaseLayers()
+{
+  for(size_t i=0;i<sizeof(all_layers)/sizeof(all_layers[0]);i++)
   {
-    x=0;
-    y=0;
-    /*draw score */
+    LayerCache& layer=*all_layers[i];
+    if(layer.framebuffer==0)
+      continue;
+    deleteFramebuffer(layer.framebuffer);
+    deleteTexture(layer.color);
+    deleteTexture(layer.depth);
   }
-  draw_rect(x,y,0);
-  draw_rect(x,y+4,0);
-  draw_rect(x,y+8,0);
-  draw_rect(x-2,y+2,90);
-  draw_rect(x-2,y+6,90);
-
-  draw_rect(x-5-2,y+2,90);
-  draw_rect(x-5-2,y+6,90);
-  draw_rect(x-5,y+4,0);
-  draw_rect(x-5,y+8,0);
-  draw_rect(x-5+2,y+6,90);
-  draw_rect(x-5-0,y+2,-45);
-
-  draw_rect(x-5*2,y,0);
-  draw_rect(x-5*2-2,y+2,90);
-  draw_rect(x-5*2-2,y+6,90);
-  draw_rect(x-5*2,y+8,0);
-  draw_rect(x-5*2+2,y+2,90);
-  draw_rect(x-5*2+2,y+6,90);
-
-  draw_rect(x-5*3,y,0);
-  draw_rect(x-5*3-2,y+2,90);
-  draw_rect(x-5*3-2,y+6,90);
-  draw_rect(x-5*3,y+8,0);
-
-  draw_rect(x-5*4,y,0);
-  draw_rect(x-5*4+2,y+2,90);
-  draw_rect(x-5*4,y+4,0);
-  draw_rect(x-5*4-2,y+6,90);
-  draw_rect(x-5*4,y+8,0);
-
-
+}
 
-  if(flag_option==0)
+/* Draw the layer, from its texture when it is still current or into it first when it is not */
+void compositeLayer(LayerCache& layer)
+{
+  if(!use_layer_cache)
   {
-    y=60;
-  draw_rect(x,y,0);
-  draw_rect(x+2,y+2,90);
-  draw_rect(x,y+4,0);
-  draw_rect(x-2,y+6,90);
-  draw_rect(x,y+8,0);
-
-  draw_rect(x-5,y,0);
-  draw_rect(x-5,y+4,0);
-  draw_rect(x-5,y+8,0);
-  draw_rect(x-5-2,y+2,90);
-  draw_rect(x-5-2,y+6,90);
-
-  draw_rect(x-5*2-1+2*sin(20.0*M_PI/180),y+2*cos(20.0*M_PI/180),70);
-  draw_rect(x-5*2-1+6*sin(20.0*M_PI/180),y+6*cos(20.0*M_PI/180),70);
-  draw_rect(x-5*2-1-2*sin(20.0*M_PI/180),y+2*cos(20.0*M_PI/180),-70);
-  draw_rect(x-5*2-1-6*sin(20.0*M_PI/180),y+6*cos(20.0*M_PI/180),-70);
-
-  draw_rect(x-5*3-2,y+2,90);
-  draw_rect(x-5*3-2,y+6,90);
-
-  draw_rect(x-5*4,y,0);
-  draw_rect(x-5*4-2,y+2,90);
-  draw_rect(x-5*4-2,y+6,90);
+    layer.fill();
+    return;
+  }
 
+  const glm::mat4& camera=VP[render_slot];
+  if(!layer.valid || layer.reshapes!=reshape_count || memcmp(&layer.VP,&camera,sizeof(glm::mat4)))
+  {
+    if(layer.width!=framebuffer_width || layer.height!=framebuffer_height)
+      allocateLayer(layer);
+    glBindFramebuffer(GL_FRAMEBUFFER, layer.framebuffer);
+    glClear (GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    layer.fill();
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    layer.reshapes=reshape_count;
+    layer.VP=camera;
+    layer.valid=true;
+    frame_stats.layer_redraws++;
   }
 
+  useProgram (layerProgramID,-1);
+  setPolygonMode (GL_FILL);
+  glActiveTexture(GL_TEXTURE1);
+  glBindTexture(GL_TEXTURE_2D, layer.depth);
+  glActiveTexture(GL_TEXTURE0);
+  glBindTexture(GL_TEXTURE_2D, layer.color);
+  // disc_quad may live in the shared static buffer, so start from its own vertices
+  bindVertexArray (disc_quad->VertexArrayID);
+  glDrawElementsBaseVertex(disc_quad->PrimitiveMode, disc_quad->NumIndices, GL_UNSIGNED_SHORT, (void*)0, disc_quad->BaseVertex);
+  frame_stats.draw_calls++;
+}
 
+void compositeBorders()
+{
+  compositeLayer(border_layer);
 }
 
+void compositeHUD()
+{
+  compositeLayer(hud_layer);
+}
 
-void draw (double x,double y)
+void compositeGameOverHUD()
 {
-  // clear the color and depth in the frame buffer
-  glClear (GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+  compositeLayer(gameover_hud_layer);
+}
+
 
-  // use the loaded shader program
-  // Don't change unless you know what you are doing
-  glUseProgram (programID);
 
+/* Advance the game one tick : camera, drags, scoring, movement and collisions. Drawing is left to extract() */
+void update (double x,double y)
+{
   // Eye - Location of camera. Don't change unless you are sure!!
   glm::vec3 eye ( 5*cos(camera_rotation_angle*M_PI/180.0f), 0, 5*sin(camera_rotation_angle*M_PI/180.0f) );
   // Target - Where is the camera looking at.  Don't change unless you are sure!!
@@ -1966,10 +3439,14 @@ void draw (double x,double y)
 
 //  Matrices.view = glm::lookAt(glm::vec3( pan,pany,3), glm::vec3(pan,pany,0), glm::vec3(0,1,0)); // Fixed camera for 2D (ortho) in XY plane
   Matrices.projection = glm::ortho(-100.0f+zoom+pan, 100.0f-zoom+pan, -100.0f+zoom+pany, 100.0f-zoom+pany, 0.1f, 500.0f);
+  view_left=-100+zoom+pan;
+  view_right=100-zoom+pan;
+  view_bottom=-100+zoom+pany;
+  view_top=100-zoom+pany;
 
   // Compute ViewProject matrix as view/camera might not be changed for this frame (basic scenario)
   //  Don't change unless you are sure!!
-  VP = Matrices.projection * Matrices.view;
+  VP[update_slot] = Matrices.projection * Matrices.view;
 
   // Send our transformation to the currently bound shader, in the "MVP" uniform
   // For each model you render, since the MVP will be different (at least the M part)
@@ -2047,6 +3524,21 @@ long long int r;
     }
   }
 
+  // Level ups and the N/M keys both change the speed, and falling bricks take it up at once.
+  // They are rebased the same way when the fall origin moves on
+  bool new_fall_origin=game_clock-fall_origin>=FALL_ORIGIN_PERIOD;
+  if(new_fall_origin)
+    fall_origin=game_clock;
+  if(speed_var!=rebased_speed_var || new_fall_origin)
+  {
+    for(long long int i=f;i<poi;i++)
+    {
+      block[i%1000].rebase();
+      writeBrickSpawn(i%1000);
+    }
+    rebased_speed_var=speed_var;
+  }
+
   if(exit_flag==1)
   {
       if(start_flag==1)
@@ -2077,39 +3569,16 @@ long long int r;
         }
         hit=0;
         dump=0;
-        for(int i=f;i<poi;i++)
-        {
-          free(block[i].brick);
-        }
         f=0;
         poi=0;
-        for(int i=f2;i<poi2;i++)
-        {
-          free(blt[i].bullet);
-        }
         f2=0;
         poi2=0;
+        bursts_kept_from=bursts_started;
         start_flag=0;
-        return;
-      }
-      else
-      {
-      draw_boxes(2);
-      draw_scoretext(1);
-      draw_score(2);
-      draw_gameover();
       }
       return;
   }
 
-  draw_boxes(0);
-  draw_boxes(1);
-  draw_scoretext(0);
-  draw_level();
-  draw_score(3);
-  draw_score(0);
-  draw_score(1);
-
   if(flag_mirror==1)
   {
     for(int i=0;i<4;i++)
@@ -2119,28 +3588,8 @@ long long int r;
     flag_mirror=0;
   }
 
-        /*Boarder Creation*/
-
-    Matrices.model = glm::mat4(1.0f);
-    glm::mat4 rotateBoarder = glm::rotate((float)(0*M_PI/180.0f), glm::vec3(0,0,1)); 
-    glm::mat4 transBoarder = glm::translate (glm::vec3(0,-65.5,0));
-    Matrices.model *= transBoarder*rotateBoarder;
-    MVP = VP * Matrices.model;
-    glUniformMatrix4fv(Matrices.MatrixID,1,GL_FALSE,&MVP[0][0]);
-    draw3DObject(boarder);
-
-    Matrices.model = glm::mat4(1.0f);
-    rotateBoarder = glm::rotate((float)(90*M_PI/180.0f), glm::vec3(0,0,1)); 
-    transBoarder = glm::translate (glm::vec3(71,0,0));
-    Matrices.model *= transBoarder*rotateBoarder;
-    MVP = VP * Matrices.model;
-    glUniformMatrix4fv(Matrices.MatrixID,1,GL_FALSE,&MVP[0][0]);
-    draw3DObject(boarder);
-
-
-
           /*Laser Movement*/
-              Laser.draw();
+              Laser.move();
 
 
      /* Bullet Movement */ 
@@ -2149,7 +3598,7 @@ long long int r;
   {
 
   for(int i=f2;i<poi2;i++)
-    blt[i%1000].draw();
+    blt[i%1000].step();
 
   r=f2;
   for(int i=f2;i<poi2;i++)
@@ -2171,35 +3620,204 @@ long long int r;
   {
     block[poi%1000].generateBlock();
     block[poi%1000].createBrick();
+    writeBrickSpawn(poi%1000);
     brick_flag=0;
     poi++;
   }
 
+  // Caught or dumped bricks, and those that fell out of [f,poi), leave the spawn table
+  long long int first=f;
   for(int i=f;i<(poi);i++)
   {
+     int removed=block[i%1000].rem_flag;
      block[i%1000].checkBlock();
+     if(block[i%1000].rem_flag!=removed)
+       writeBrickSpawn(i%1000);
   }
+  for(long long int i=first;i<f;i++)
+    clearBrickSpawn(i%1000);
   fall_flag=0;
 
 
        /*Baskets Movement*/
 
   for(int i=0;i<2;i++)
+    bucket[i].move();
+  //camera_rotation_angle++; // Simulating camera rotation
+}
+
+/* Extraction : turn the state update() left into this tick's draw records. Nothing here changes the game,
+   so update() can run without it and the renderer only ever sees the records */
+void extract ()
+{
+  snapshot_clocks[update_slot]=game_clock;
+  fall_origins[update_slot]=fall_origin;
+
+  if(exit_flag==1)
   {
-    if(ctrl==1)
-      bucket[(i+1)%2].draw();
-    else
-      bucket[i].draw();
+    draw_boxes(2);
+    showLabel(final_score_label);
+    draw_score(2);
+    showLabel(gameover_label);
+    submitBatch(LAYER_HUD,compositeGameOverHUD);
+    submitBatch(LAYER_HUD,drawDigits);
+    return;
+  }
+
+  draw_boxes(0);
+  draw_boxes(1);
+  showLabel(score_label);
+  showLabel(lives_label);
+  showLabel(level_label);
+  draw_score(3);
+  draw_score(0);
+  draw_score(1);
+  submitBatch(LAYER_HUD,compositeHUD);
+  submitBatch(LAYER_HUD,drawDigits);
+
+        /*Boarder Creation*/
+
+  submitBatch(LAYER_BACKGROUND,compositeBorders);
+
+  Laser.extract();
+
+  for(int i=f2;i<poi2;i++)
+    blt[i%1000].extract();
+  submitBatch(LAYER_BULLETS,drawBullets);
+
+  if(gpu_bricks)
+  {
+    copyBrickSpawns();
+    submitBatch(LAYER_BRICKS,drawFallingBricks);
+  }
+  else
+  {
+    for(int i=f;i<poi;i++)
+      block[i%1000].extract();
+    submitBatch(LAYER_BRICKS,drawBricks);
+  }
+
+  if(use_particles)
+  {
+    if(burst_totals[update_slot]!=bursts_started)
+    {
+      memcpy(burst_histories[update_slot],bursts,sizeof(bursts));
+      burst_totals[update_slot]=bursts_started;
+    }
+    burst_firsts[update_slot]=bursts_kept_from;
+    submitBatch(LAYER_FOREGROUND,drawParticles);
   }
 
+  // The key sorts by program before submission order, so the bucket under control needs its own layer to
+  // have its rims as well as its basket drawn over the other bucket
+  int controlled=(ctrl==1)?0:1;
+  bucket[1-controlled].extract(LAYER_FOREGROUND);
+  bucket[controlled].extract(LAYER_CONTROLLED);
 
-    /* Mirror Placement*/
-  
   for(int i=0;i<4;i++)
+    mirrors[i].extract();
+}
+
+/* Hand the slot just built to the render thread and take back the one it left, emptied for the next tick */
+void publishSnapshot ()
+{
+  update_slot = ready_slot.exchange(update_slot|SNAPSHOT_NEW) & ~SNAPSHOT_NEW;
+  render_queues[update_slot].clear();
+  num_batch_quads[update_slot]=0;
+  num_brick_instances[update_slot]=0;
+  num_bullet_instances[update_slot]=0;
+  num_hud_numbers[update_slot]=0;
+  num_shown_labels[update_slot]=0;
+  update_stats[update_slot]=FrameStats();
+}
+
+/* Take the newest published slot for drawing, if one arrived since the last call */
+bool acquireSnapshot ()
+{
+  if(!(ready_slot.load() & SNAPSHOT_NEW))
+    return false;
+  render_slot = ready_slot.exchange(render_slot) & ~SNAPSHOT_NEW;
+  return true;
+}
+
+/* Control based on time (Time based transformation like 5 degrees rotation every 0.5s) */
+void updateTimers ()
+{
+        current_time = glfwGetTime(); // Time in seconds
+        if ((current_time - last_update_time) >= 1-speed_var*0.05) { // atleast 0.5s elapsed since last frame
+            // do something every 0.5 seconds ..
+            brick_flag=1;
+            last_update_time = current_time;
+        }
+        if ((current_time - update_mirror) >= 0.075-speed_var*0.001) { // atleast 0.5s elapsed since last frame
+            // do something every 0.5 seconds ..
+            flag_mirror=1;
+            update_mirror = current_time;
+        }        
+        if ((current_time - update_shoot) >= 1) { // atleast 0.5s elapsed since last frame
+            flag_shoot=1;
+            update_shoot = current_time;
+        }
+        if ((current_time - update_bullet) >= 0.01) { // atleast 0.5s elapsed since last frame
+            flag_bullet=1;
+            update_bullet = current_time;
+        }
+        if ((current_time - updatetime_fall) >= 0.075-speed_var*0.001) { // atleast 0.5s elapsed since last frame
+            fall_flag=1;
+            updatetime_fall = current_time;
+        }
+}
+
+/* Update thread : advance the game at a fixed rate and publish a snapshot per tick, whatever the render thread is doing */
+void updateLoop ()
+{
+  double next_tick = glfwGetTime(),last_tick = next_tick;
+  while(update_running)
+  {
+    applyInputEvents();
+    double now = glfwGetTime();
+    if(pause_flag!=1)
+      game_clock += now-last_tick;
+    last_tick = now;
+    if(pause_flag!=1)
+    {
+      std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+      update(cursor_x,cursor_y);
+      update_stats[update_slot].update_ms = millisecondsSince(start);
+
+      start = std::chrono::steady_clock::now();
+      extract();
+      update_stats[update_slot].extract_ms = millisecondsSince(start);
+
+      publishSnapshot();
+      updateTimers();
+    }
+
+    next_tick += 1/UPDATE_RATE;
+    now = glfwGetTime();
+    if(next_tick<now)
+      next_tick = now;  // fell behind : carry on from here rather than run a burst of ticks
+    else
+      std::this_thread::sleep_for(std::chrono::duration<double>(next_tick-now));
+  }
+}
+
+/* Draw the latest snapshot, or the previous one again if the update thread has not published since */
+void render ()
+{
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  if(acquireSnapshot())
   {
-    mirrors[i].drawMirror();
+    addStats(frame_stats, update_stats[render_slot]);
+    snapshot_drawn=true;
   }
-  //camera_rotation_angle++; // Simulating camera rotation
+
+  // clear the color and depth in the frame buffer
+  glClear (GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+  uploadCamera();
+  executeRenderQueue();
+  nextStreamRegion();
+  frame_stats.render_ms = millisecondsSince(start);
 }
 
 /* Initialise glfw window, I/O callbacks and the renderer to use */
@@ -2213,12 +3831,17 @@ GLFWwindow* initGLFW (int width, int height)
 //        exit(EXIT_FAILURE);
     }
 
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+    // The indirect path needs a 4.3 context; without one it falls back to 3.3 and the direct loop
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, use_indirect ? 4 : 3);
     glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
     glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
     glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
 
     window = glfwCreateWindow(width, height, "Brick Breaker", NULL, NULL);
+    if (!window && use_indirect) {
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+        window = glfwCreateWindow(width, height, "Brick Breaker", NULL, NULL);
+    }
 
     if (!window) {
         glfwTerminate();
@@ -2251,12 +3874,15 @@ GLFWwindow* initGLFW (int width, int height)
     return window;
 }
 
-/* Initialize the OpenGL rendering properties */
-/* Add all the models to be created here */
-void initGL (GLFWwindow* window, int width, int height)
+/* Startup timings, reported once the first frame is on screen */
+std::chrono::steady_clock::time_point program_start;
+double mesh_build_ms=0,shader_compile_ms=0,mesh_upload_ms=0;
+
+/* Build the CPU side of every startup mesh. With the static buffer on this makes
+   no GL calls, so it runs on a worker thread while the shaders compile */
+void createModels ()
 {
-    /* Objects should be created before any other gl function and shaders */
-    // Create the models
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
   bucket[1].extra=80;
   bucket[0].extra=0;
   for(int i=0;i<2;i++)
@@ -2277,15 +3903,142 @@ void initGL (GLFWwindow* window, int width, int height)
   mirrors[2].x=60;mirrors[2].y=70;mirrors[2].rotation=-50;
   mirrors[3].x=60;mirrors[3].y=-50;mirrors[3].rotation=50;
 
-  createRectangle();
-  createRectangle2();
   createLine();
+  createDiscQuad();
+  getCircleMesh(bullet_circle);
+  if(collecting_static_meshes)
+    buildStaticMeshes();
+  mesh_build_ms = millisecondsSince(start);
+}
+
+/* Initialize the OpenGL rendering properties */
+/* Add all the models to be created here */
+void initGL (GLFWwindow* window, int width, int height)
+{
+    // Create the models - with the static buffer they are collected on the CPU and uploaded
+    // in one pass by uploadStaticMeshes(), otherwise each one is uploaded as it is made
+    collecting_static_meshes = use_static_buffer;
+    std::thread mesh_builder;
+    if(use_static_buffer)
+      mesh_builder = std::thread(createModels);
+    else
+      createModels();
+
     // Create and compile our GLSL program from the shaders
-    programID = LoadShaders( "Sample_GL.vert", "Sample_GL.frag" );
-    // Get a handle for our "MVP" uniform
-    Matrices.MatrixID = glGetUniformLocation(programID, "MVP");
+    std::chrono::steady_clock::time_point compile_start = std::chrono::steady_clock::now();
+    if(vertex_format==VERTEX_FLOAT3)
+      programID = LoadShaders( "Sample_GL.vert", "Sample_GL.frag" );
+    else
+      programID = LoadShaders( "Packed_GL.vert", "Sample_GL.frag" );
+    // Get handles for the per-object uniforms; VP comes from the camera block
+    useCameraBlock(programID);
+    Matrices.TransformID = glGetUniformLocation(programID, "transform");
+    Matrices.TiltID = glGetUniformLocation(programID, "tilt");
+    Matrices.TintID = glGetUniformLocation(programID, "tint");
+
+    // Meshes without a colour buffer read this constant white colour
+    glVertexAttrib3f(1,1,1,1);
+
+    // Instanced brick program : palette is indexed by Bricks::val2
+    brickProgramID = LoadShaders( "Brick_GL.vert", "Sample_GL.frag" );
+    useCameraBlock(brickProgramID);
+    BrickPaletteID = glGetUniformLocation(brickProgramID, "palette");
+    useProgram (brickProgramID,-1);
+    glUniform3fv(BrickPaletteID,3,brick_palette);
+
+    discProgramID = LoadShaders( "Disc_GL.vert", "Disc_GL.frag" );
+    useCameraBlock(discProgramID);
+    DiscID = glGetUniformLocation(discProgramID, "disc");
+    DiscTintID = glGetUniformLocation(discProgramID, "tint");
+    DiscClipID = glGetUniformLocation(discProgramID, "clip");
+
+    // Digits are always black
+    digitProgramID = LoadShaders( "Digit_GL.vert", "Digit_GL.frag" );
+    useCameraBlock(digitProgramID);
+    useProgram (digitProgramID,-1);
+    glUniform3f(glGetUniformLocation(digitProgramID, "tint"),0,0,0);
+
+    // Text is always black, read from texture unit 0
+    textProgramID = LoadShaders( "Text_GL.vert", "Text_GL.frag" );
+    useCameraBlock(textProgramID);
+    useProgram (textProgramID,-1);
+    glUniform3f(glGetUniformLocation(textProgramID, "tint"),0,0,0);
+    glUniform1i(glGetUniformLocation(textProgramID, "atlas"),0);
+
+    // Cached layers read their colour from unit 0 and their depth from unit 1
+    layerProgramID = LoadShaders( "Layer_GL.vert", "Layer_GL.frag" );
+    useCameraBlock(layerProgramID);
+    useProgram (layerProgramID,-1);
+    glUniform1i(glGetUniformLocation(layerProgramID, "layerColor"),0);
+    glUniform1i(glGetUniformLocation(layerProgramID, "layerDepth"),1);
+
+    if(use_indirect && (!GLAD_GL_VERSION_4_3 || !use_static_buffer))
+    {
+      printf("--indirect needs OpenGL 4.3 and the static buffer, drawing directly instead\n");
+      use_indirect = 0;
+    }
+    if(use_indirect)
+    {
+      indirectProgramID = LoadShaders( "Indirect_GL.vert", "Sample_GL.frag" );
+      useCameraBlock(indirectProgramID);
+    }
+
+    if(gpu_bricks)
+    {
+      fallingBrickProgramID = LoadShaders( "BrickFalling_GL.vert", "Sample_GL.frag" );
+      useCameraBlock(fallingBrickProgramID);
+      FallingBrickTimeID = glGetUniformLocation(fallingBrickProgramID, "time");
+      useProgram (fallingBrickProgramID,-1);
+      glUniform3fv(glGetUniformLocation(fallingBrickProgramID, "palette"),3,brick_palette);
+    }
+
+    if(use_particles)
+    {
+      static const char * const particle_varyings[] = {"position", "velocity", "life", "color"};
+      particleUpdateProgramID = LoadShaders( "ParticleUpdate_GL.vert", NULL, particle_varyings, 4 );
+      ParticleBurstsID = glGetUniformLocation(particleUpdateProgramID, "bursts");
+      ParticleBurstColorsID = glGetUniformLocation(particleUpdateProgramID, "burstColors");
+      ParticleBurstCountID = glGetUniformLocation(particleUpdateProgramID, "burstCount");
+      ParticleDtID = glGetUniformLocation(particleUpdateProgramID, "dt");
+      useProgram (particleUpdateProgramID,-1);
+      glUniform1f(glGetUniformLocation(particleUpdateProgramID, "lifetime"),PARTICLE_LIFETIME);
+
+      particleProgramID = LoadShaders( "Particle_GL.vert", "Sample_GL.frag" );
+      useCameraBlock(particleProgramID);
+      useProgram (particleProgramID,-1);
+      glUniform1f(glGetUniformLocation(particleProgramID, "lifetime"),PARTICLE_LIFETIME);
+      glEnable(GL_PROGRAM_POINT_SIZE);
+    }
+
+    // Instanced bullets share the disc fragment shader; colour and clip never change
+    bulletProgramID = LoadShaders( "DiscInstanced_GL.vert", "Disc_GL.frag" );
+    useCameraBlock(bulletProgramID);
+    useProgram (bulletProgramID,-1);
+    glUniform3f(glGetUniformLocation(bulletProgramID, "tint"),0,1,1);
+    glUniform2f(glGetUniformLocation(bulletProgramID, "clip"),0,1);
+    shader_compile_ms = millisecondsSince(compile_start);
+
+  std::chrono::steady_clock::time_point upload_start = std::chrono::steady_clock::now();
+  if(mesh_builder.joinable())
+    mesh_builder.join();
+  uploadStaticMeshes();
+  createStreamBuffer();
+  if(use_indirect)
+    createIndirectVAO();
+
+  // The brick and bullet quads carry their own instance attributes, so they keep VAOs of their own
+  createBrickQuad();
+  if(gpu_bricks)
+    createFallingBrickQuad();
+  createBulletQuad();
+  if(use_particles)
+    createParticles();
+  createBatch();
+  createDigitQuad();
+  createGlyphTexture();
+  createCameraBuffer();
+  mesh_upload_ms = millisecondsSince(upload_start);
 
-    
     reshapeWindow (window, width, height);
 
     // Background color of the scene
@@ -2301,24 +4054,100 @@ void initGL (GLFWwindow* window, int width, int height)
     cout << "GLSL: " << glGetString(GL_SHADING_LANGUAGE_VERSION) << endl;
 }
 
+/* Release every GL object while the context is still current, then report anything left behind */
+void destroyGL ()
+{
+  for(int i=0;i<4;i++)
+    mirrors[i].destroyMeshes();
+  Laser.destroyMeshes();
+  for(int i=0;i<2;i++)
+    bucket[i].destroyMeshes();
+  delete boarder;
+  delete disc_quad;
+  delete brick_quad;
+  delete falling_brick_quad;
+  delete bullet_quad;
+  delete digit_quad;
+  boarder=disc_quad=brick_quad=falling_brick_quad=bullet_quad=digit_quad=NULL;
+  releaseMeshCache();
+  releaseStaticMeshes();
+  releaseBatch();
+  releaseIndirectVAO();
+  releaseLabels();
+  releaseLayers();
+  releaseParticles();
+  releaseStreamBuffer();
+  deleteBuffer(DigitInstanceBuffer);
+  deleteBuffer(FallingBrickBuffer);
+  deleteBuffer(quad_index_buffer);
+  deleteBuffer(camera_buffer);
+
+  useProgram (0,-1);
+  glDeleteProgram (programID);
+  glDeleteProgram (brickProgramID);
+  glDeleteProgram (fallingBrickProgramID);
+  glDeleteProgram (discProgramID);
+  glDeleteProgram (bulletProgramID);
+  glDeleteProgram (indirectProgramID);
+  glDeleteProgram (digitProgramID);
+  glDeleteProgram (textProgramID);
+  glDeleteProgram (layerProgramID);
+  glDeleteProgram (particleUpdateProgramID);
+  glDeleteProgram (particleProgramID);
+
+  printf("GL objects still alive: %lld vertex arrays, %lld buffers, %lld textures, %lld framebuffers\n",
+         live_vertex_arrays, live_buffers, live_textures, live_framebuffers);
+}
+
 int main (int argc, char** argv)
 {
     int width = 800;
     int height = 600;
     double x,y;
+    bool first_frame_reported=false;
+
+    program_start = std::chrono::steady_clock::now();
+    for(int i=1;i<argc;i++)
+    {
+        if(!strcmp(argv[i],"--mesh-discs"))
+            sdf_discs=0;
+        else if(!strcmp(argv[i],"--no-static-buffer"))
+            use_static_buffer=0;
+        else if(!strcmp(argv[i],"--no-state-cache"))
+            use_state_cache=0;
+        else if(!strcmp(argv[i],"--indirect"))
+            use_indirect=1;
+        else if(!strcmp(argv[i],"--particles"))
+            use_particles=1;
+        else if(!strcmp(argv[i],"--gpu-bricks"))
+            gpu_bricks=1;
+        else if(!strcmp(argv[i],"--no-layer-cache"))
+            use_layer_cache=0;
+        else if(!strcmp(argv[i],"--stream-orphan"))
+            use_stream_orphan=1;
+        else if(!strcmp(argv[i],"--stats"))
+            print_stats=1;
+        else if(!strcmp(argv[i],"--packed"))
+            vertex_format=VERTEX_PACKED_FLOAT;
+        else if(!strcmp(argv[i],"--packed-half"))
+            vertex_format=VERTEX_PACKED_HALF;
+    }
 
     GLFWwindow* window = initGLFW(width, height);
 
     initGL (window, width, height);
+    long long int startup_buffers = gl_buffers_created;
+
+    update_running = true;
+    std::thread updater(updateLoop);
 
 //    glfwGetCursorPos(window, &xpos, &ypos);
     // Draw in loop 
     while (!glfwWindowShouldClose(window)) {
 
         // OpenGL Draw commands
-        glfwGetCursorPos(window, &xpos, &ypos);
-        x=(xpos-400)*1.0/4;
-        y=(300-ypos)*1.0/3;
+        render();
+        endFrameStats();
 /*        if(exit_flag==1)
         {
           update_exit--;
@@ -2333,43 +4162,33 @@ int main (int argc, char** argv)
 //        printf("%lf\n %lf\n",xpos,ypos);
         // Swap Frame Buffer in double buffering
         glfwSwapBuffers(window);
+        if(snapshot_drawn && !first_frame_reported)
+        {
+            printf("Time to first frame: %.1f ms (mesh build %.1f ms, shader compile %.1f ms, mesh upload %.1f ms)\n",
+                   millisecondsSince(program_start), mesh_build_ms, shader_compile_ms, mesh_upload_ms);
+            first_frame_reported=true;
+        }
 
         // Poll for Keyboard and mouse events
         glfwPollEvents();
 
-        if(pause_flag==1)
-          continue;
-//      cout << '\a'<<flush;        
-
-        draw(x,y);
+        glfwGetCursorPos(window, &xpos, &ypos);
+        x=(xpos-400)*1.0/4;
+        y=(300-ypos)*1.0/3;
+        cursor_x=x;
+        cursor_y=y;
+    }
 
-        // Control based on time (Time based transformation like 5 degrees rotation every 0.5s)
-        current_time = glfwGetTime(); // Time in seconds
-        if ((current_time - last_update_time) >= 1-speed_var*0.05) { // atleast 0.5s elapsed since last frame
-            // do something every 0.5 seconds ..
-            brick_flag=1;
-            last_update_time = current_time;
-        }
-        if ((current_time - update_mirror) >= 0.075-speed_var*0.001) { // atleast 0.5s elapsed since last frame
-            // do something every 0.5 seconds ..
-            flag_mirror=1;
-            update_mirror = current_time;
-        }        
-        if ((current_time - update_shoot) >= 1) { // atleast 0.5s elapsed since last frame
-            flag_shoot=1;
-            update_shoot = current_time;
-        }
-        if ((current_time - update_bullet) >= 0.01) { // atleast 0.5s elapsed since last frame
-            flag_bullet=1;
-            update_bullet = current_time;
-        }
-        if ((current_time - updatetime_fall) >= 0.075-speed_var*0.001) { // atleast 0.5s elapsed since last frame
-            fall_flag=1;
-            updatetime_fall = current_time;
-        }
+    update_running = false;
+    updater.join();
 
-    }
+    printf("Mesh cache: %lld hits, %lld misses\n", mesh_cache_hits, mesh_cache_misses);
+    printf("GL buffers created: %lld at startup, %lld during play\n", startup_buffers, gl_buffers_created-startup_buffers);
+    printf("Bytes uploaded: %lld mesh, %lld total\n", mesh_bytes_uploaded, bytes_uploaded);
+    printTotalStats();
 
+    destroyGL();
+    glfwDestroyWindow(window);
     glfwTerminate();
 //    exit(EXIT_SUCCESS);
 }
@@ -0,0 +1,96 @@
+#ifndef GEOMETRY_H
+#define GEOMETRY_H
+
+/* Vertex tables generated at compile time.
+   Nothing in here depends on GL, so the same tables can be used by a headless build. */
+
+namespace geometry {
+
+constexpr double PI = 3.14159265358979323846;
+
+/* Taylor series sine, argument reduced to [-pi,pi] first */
+constexpr double sine (double x)
+{
+    while(x>PI)
+        x-=2*PI;
+    while(x<-PI)
+        x+=2*PI;
+    double term=x,sum=x;
+    for(int n=1;n<12;n++)
+    {
+        term*=-x*x/((2*n)*(2*n+1));
+        sum+=term;
+    }
+    return sum;
+}
+
+constexpr double cosine (double x)
+{
+    return sine(x+PI/2);
+}
+
+constexpr double radians (double degrees)
+{
+    return degrees*PI/180;
+}
+
+/* Filled circle as N triangles fanned around (cx,cy) - same layout as GL_TRIANGLES with 3*N vertices */
+template <int N>
+struct Circle {
+    float cx,cy,radius;
+    float data[N*9];
+
+    constexpr Circle (float x, float y, float r) : cx(x), cy(y), radius(r), data()
+    {
+        for(int i=0;i<N;i++)
+        {
+            data[9*i]=cx;
+            data[9*i+1]=cy;
+            data[9*i+2]=0;
+
+            data[9*i+3]=cx+radius*cosine(i*2*PI/N);
+            data[9*i+4]=cy+radius*sine(i*2*PI/N);
+            data[9*i+5]=0;
+
+            data[9*i+6]=cx+radius*cosine(((i+1)%N)*2*PI/N);
+            data[9*i+7]=cy+radius*sine(((i+1)%N)*2*PI/N);
+            data[9*i+8]=0;
+        }
+    }
+
+    static constexpr int vertices = 3*N;
+};
+
+/* Axis aligned rectangle from (x0,y0) to (x1,y1) as 4 corners, drawn with quad_indices */
+struct IndexedQuad {
+    float data[12];
+
+    constexpr IndexedQuad (float x0, float y0, float x1, float y1) : data{
+        x0,y0,0,
+        x0,y1,0,
+        x1,y1,0,
+        x1,y0,0,
+    } {}
+
+    static constexpr int vertices = 4;
+};
+
+/* Two triangles over the corners of an IndexedQuad, both wound the same way */
+constexpr unsigned short quad_indices[6] = {0,1,2, 2,3,0};
+
+/* quad_indices repeated for N consecutive IndexedQuads, for drawing many quads from one buffer */
+template <int N>
+struct QuadIndices {
+    unsigned short data[N*6];
+
+    constexpr QuadIndices () : data()
+    {
+        for(int i=0;i<N;i++)
+            for(int k=0;k<6;k++)
+                data[6*i+k]=4*i+quad_indices[k];
+    }
+};
+
+}
+
+#endif
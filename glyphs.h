@@ -0,0 +1,91 @@
+#ifndef GLYPHS_H
+#define GLYPHS_H
+
+#include "geometry.h"
+
+/* HUD lettering baked into a coverage atlas at compile time.
+   Each glyph is made of the same 4x1 bars draw_rect used to place by hand */
+
+namespace glyphs {
+
+/* A 4x1 bar centred at (x,y), turned angle degrees */
+struct Stroke {
+    float x,y;
+    float c,s;
+
+    constexpr Stroke () : x(0), y(0), c(1), s(0) {}
+    constexpr Stroke (double sx, double sy, double angle)
+        : x(sx), y(sy), c(geometry::cosine(geometry::radians(angle))), s(geometry::sine(geometry::radians(angle))) {}
+
+    constexpr bool covers (float px, float py) const
+    {
+        float u = c*(px-x) + s*(py-y);
+        float v = -s*(px-x) + c*(py-y);
+        return u>=-2 && u<=2 && v>=-0.5f && v<=0.5f;
+    }
+};
+
+struct Glyph {
+    char letter;
+    int count;
+    Stroke strokes[6];
+};
+
+constexpr double S20 = geometry::sine(geometry::radians(20));
+constexpr double C20 = geometry::cosine(geometry::radians(20));
+
+/* Strokes relative to the letter's origin : the centre of its bottom bar */
+constexpr Glyph table[] = {
+    {'A', 5, {{-2*S20,6*C20,70}, {-6*S20,2*C20,70}, {2*S20,6*C20,-70}, {6*S20,2*C20,-70}, {0,2,0}}},
+    {'C', 4, {{0,0,0}, {-2,2,90}, {-2,6,90}, {0,8,0}}},
+    {'E', 5, {{0,0,0}, {0,4,0}, {0,8,0}, {-2,2,90}, {-2,6,90}}},
+    {'G', 6, {{-1,0,0}, {0,3,0}, {-1,8,0}, {-3,2,90}, {-3,6,90}, {1,1,90}}},
+    {'I', 2, {{-2,2,90}, {-2,6,90}}},
+    {'L', 3, {{0,0,0}, {-2,2,90}, {-2,6,90}}},
+    {'M', 6, {{-1,2,90}, {-1,6,90}, {2,2,90}, {2,6,90}, {2-6*S20,6*C20,-70}, {-1+6*S20,6*C20,70}}},
+    {'O', 6, {{0,0,0}, {-2,2,90}, {-2,6,90}, {0,8,0}, {2,2,90}, {2,6,90}}},
+    {'R', 6, {{-2,2,90}, {-2,6,90}, {0,4,0}, {0,8,0}, {2,6,90}, {0,2,-45}}},
+    {'S', 5, {{0,0,0}, {2,2,90}, {0,4,0}, {-2,6,90}, {0,8,0}}},
+    {'V', 4, {{2*S20,2*C20,70}, {6*S20,6*C20,70}, {-2*S20,2*C20,-70}, {-6*S20,6*C20,-70}}},
+};
+
+constexpr int GLYPHS = sizeof(table)/sizeof(table[0]);
+
+/* Every glyph gets a cell from (-4,-1) to (4,9) around its origin, PIXELS texels per unit */
+constexpr float CELL_LEFT = -4, CELL_BOTTOM = -1;
+constexpr int CELL_UNITS_X = 8, CELL_UNITS_Y = 10;
+constexpr int PIXELS = 4;
+constexpr int CELL_WIDTH = CELL_UNITS_X*PIXELS, CELL_HEIGHT = CELL_UNITS_Y*PIXELS;
+constexpr int ATLAS_WIDTH = GLYPHS*CELL_WIDTH, ATLAS_HEIGHT = CELL_HEIGHT;
+
+/* Index of letter in table, -1 when there is no glyph for it */
+constexpr int find (char letter)
+{
+    for(int i=0;i<GLYPHS;i++)
+        if(table[i].letter==letter)
+            return i;
+    return -1;
+}
+
+/* One byte per texel, 255 where a texel centre falls on a stroke. Row 0 is the bottom of the cells */
+struct Atlas {
+    unsigned char pixels[ATLAS_HEIGHT][ATLAS_WIDTH];
+
+    constexpr Atlas () : pixels()
+    {
+        for(int g=0;g<GLYPHS;g++)
+            for(int py=0;py<CELL_HEIGHT;py++)
+                for(int px=0;px<CELL_WIDTH;px++)
+                {
+                    float x = CELL_LEFT + (px+0.5f)/PIXELS;
+                    float y = CELL_BOTTOM + (py+0.5f)/PIXELS;
+                    for(int k=0;k<table[g].count;k++)
+                        if(table[g].strokes[k].covers(x,y))
+                            pixels[py][g*CELL_WIDTH+px] = 255;
+                }
+    }
+};
+
+}
+
+#endif